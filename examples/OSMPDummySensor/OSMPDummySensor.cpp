@@ -47,6 +47,7 @@
 #include <string>
 #include <algorithm>
 #include <cstdint>
+#include <cstring>
 #include <cmath>
 
 using namespace std;
@@ -100,32 +101,532 @@ void encode_pointer_to_integer(const void* ptr,fmi2Integer& hi,fmi2Integer& lo)
 #endif
 }
 
-bool COSMPDummySensor::get_fmi_sensor_view_in(osi3::SensorView& data)
+#ifdef ARENA_DECODING
+/* Blocks the decoding arena had to allocate beyond its initial block */
+static thread_local fmi2Integer sensor_view_in_arena_allocations = 0;
+
+void* COSMPDummySensor::sensor_view_in_arena_alloc(size_t size)
+{
+    sensor_view_in_arena_allocations++;
+    return ::operator new(size);
+}
+
+void COSMPDummySensor::sensor_view_in_arena_dealloc(void* ptr, size_t)
+{
+    ::operator delete(ptr);
+}
+#endif
+
+const void* COSMPDummySensor::fmi_sensor_view_in_buffer(int input)
+{
+    int idx = fmi_sensor_view_in_idx(input);
+    return decode_integer_to_pointer(integer_vars[idx+1],integer_vars[idx]);
+}
+
+osi3::SensorView& COSMPDummySensor::reset_fmi_sensor_view_in(int input)
 {
-    if (integer_vars[FMI_INTEGER_SENSORVIEW_IN_SIZE_IDX] > 0) {
-        void* buffer = decode_integer_to_pointer(integer_vars[FMI_INTEGER_SENSORVIEW_IN_BASEHI_IDX],integer_vars[FMI_INTEGER_SENSORVIEW_IN_BASELO_IDX]);
-        normal_log("OSMP","Got %08X %08X, reading from %p ...",integer_vars[FMI_INTEGER_SENSORVIEW_IN_BASEHI_IDX],integer_vars[FMI_INTEGER_SENSORVIEW_IN_BASELO_IDX],buffer);
-        data.ParseFromArray(buffer,integer_vars[FMI_INTEGER_SENSORVIEW_IN_SIZE_IDX]);
+    SensorViewInput& in = sensorViewInputs[input];
+#ifdef ARENA_DECODING
+    /* The decoding thread recorded the arena size, don't query it from here */
+    if (in.arena != NULL && (size_t)in.decodeBytes <= in.arenaBlock.size()) {
+        /* Last step fit into the initial block, just rewind it */
+        in.arena->Reset();
+    } else {
+        /* Grow the initial block to the high-water mark of the last step */
+        size_t needed = (in.arena != NULL) ? (size_t)in.decodeBytes : 0;
+        delete in.arena;
+        in.arenaBlock.resize(max(needed + needed/4, (size_t)ARENA_INITIAL_BLOCK_SIZE));
+        normal_log("OSMP","Growing decoding arena of input %d to %zu bytes",input+1,in.arenaBlock.size());
+        google::protobuf::ArenaOptions options;
+        options.initial_block = &in.arenaBlock[0];
+        options.initial_block_size = in.arenaBlock.size();
+        options.block_alloc = sensor_view_in_arena_alloc;
+        options.block_dealloc = sensor_view_in_arena_dealloc;
+        in.arena = new google::protobuf::Arena(options);
+    }
+    in.view = google::protobuf::Arena::CreateMessage<osi3::SensorView>(in.arena);
+#else
+    if (in.view == NULL)
+        in.view = new osi3::SensorView();
+#endif
+    return *in.view;
+}
+
+/* Runs on the decoding threads, so it must not log */
+bool COSMPDummySensor::get_fmi_sensor_view_in(int input, osi3::SensorView& data)
+{
+    fmi2Integer size = fmi_sensor_view_in_size(input);
+    if (size > 0) {
+#ifdef ARENA_DECODING
+        sensor_view_in_arena_allocations = 0;
+#endif
+        data.ParseFromArray(fmi_sensor_view_in_buffer(input),size);
+#ifdef ARENA_DECODING
+        if (data.GetArena() != NULL) {
+            uint64_t reserved = data.GetArena()->SpaceAllocated();
+            sensorViewInputs[input].decodeAllocations = sensor_view_in_arena_allocations;
+            sensorViewInputs[input].decodeBytes = reserved > INT32_MAX ? INT32_MAX : (fmi2Integer)reserved;
+        }
+#endif
         return true;
     } else {
         return false;
     }
 }
 
-void COSMPDummySensor::set_fmi_sensor_data_out(const osi3::SensorData& data)
+/*
+ * Selective SensorView Scanning
+ *
+ * Only the fields the sensor works on are decoded, all other content
+ * (lanes, stationary objects, traffic signs, ...) is skipped by its
+ * length prefix.  Singular fields occurring more than once are merged
+ * as in a full parse, except for the encoded VehicleClassification,
+ * where the last occurrence wins.
+ */
+
+static bool scan_identifier(COSMPWireReader reader, bool& has_value, uint64_t& value)
+{
+    uint32_t field, wiretype;
+    while (reader.next(field, wiretype)) {
+        bool ok;
+        if (field == osi3::Identifier::kValueFieldNumber && wiretype == OSMP_WIRETYPE_VARINT)
+            ok = has_value = reader.read_varint(value);
+        else
+            ok = reader.skip(wiretype);
+        if (!ok)
+            return false;
+    }
+    return !reader.error();
+}
+
+static bool scan_doubles(COSMPWireReader reader, uint32_t field_a, uint32_t field_b, uint32_t field_c, double& a, double& b, double& c)
+{
+    uint32_t field, wiretype;
+    while (reader.next(field, wiretype)) {
+        bool ok;
+        if (wiretype == OSMP_WIRETYPE_FIXED64 && field == field_a)
+            ok = reader.read_double(a);
+        else if (wiretype == OSMP_WIRETYPE_FIXED64 && field == field_b)
+            ok = reader.read_double(b);
+        else if (wiretype == OSMP_WIRETYPE_FIXED64 && field == field_c)
+            ok = reader.read_double(c);
+        else
+            ok = reader.skip(wiretype);
+        if (!ok)
+            return false;
+    }
+    return !reader.error();
+}
+
+static bool scan_base_moving(COSMPWireReader reader, SensorViewMovingObject& obj)
+{
+    uint32_t field, wiretype;
+    COSMPWireReader sub;
+    while (reader.next(field, wiretype)) {
+        bool ok;
+        if (wiretype != OSMP_WIRETYPE_LENGTH_DELIMITED)
+            ok = reader.skip(wiretype);
+        else if (field == osi3::BaseMoving::kPositionFieldNumber)
+            ok = reader.read_message(sub) && scan_doubles(sub,osi3::Vector3d::kXFieldNumber,osi3::Vector3d::kYFieldNumber,osi3::Vector3d::kZFieldNumber,obj.x,obj.y,obj.z);
+        else if (field == osi3::BaseMoving::kDimensionFieldNumber)
+            ok = reader.read_message(sub) && scan_doubles(sub,osi3::Dimension3d::kLengthFieldNumber,osi3::Dimension3d::kWidthFieldNumber,osi3::Dimension3d::kHeightFieldNumber,obj.length,obj.width,obj.height);
+        else if (field == osi3::BaseMoving::kOrientationFieldNumber)
+            ok = reader.read_message(sub) && scan_doubles(sub,osi3::Orientation3d::kYawFieldNumber,osi3::Orientation3d::kPitchFieldNumber,osi3::Orientation3d::kRollFieldNumber,obj.yaw,obj.pitch,obj.roll);
+        else
+            ok = reader.skip(wiretype);
+        if (!ok)
+            return false;
+    }
+    return !reader.error();
+}
+
+static bool scan_moving_object(COSMPWireReader reader, SensorViewMovingObject& obj)
+{
+    uint32_t field, wiretype;
+    COSMPWireReader sub;
+    uint64_t value;
+    while (reader.next(field, wiretype)) {
+        bool ok;
+        if (field == osi3::MovingObject::kIdFieldNumber && wiretype == OSMP_WIRETYPE_LENGTH_DELIMITED)
+            ok = reader.read_message(sub) && scan_identifier(sub,obj.has_id,obj.id);
+        else if (field == osi3::MovingObject::kBaseFieldNumber && wiretype == OSMP_WIRETYPE_LENGTH_DELIMITED)
+            ok = reader.read_message(sub) && scan_base_moving(sub,obj);
+        else if (field == osi3::MovingObject::kTypeFieldNumber && wiretype == OSMP_WIRETYPE_VARINT) {
+            ok = reader.read_varint(value);
+            obj.type = (int)value;
+        } else if (field == osi3::MovingObject::kVehicleClassificationFieldNumber && wiretype == OSMP_WIRETYPE_LENGTH_DELIMITED)
+            ok = reader.read_bytes(obj.vehicle_classification,obj.vehicle_classification_size);
+        else
+            ok = reader.skip(wiretype);
+        if (!ok)
+            return false;
+    }
+    return !reader.error();
+}
+
+static bool scan_ground_truth(COSMPWireReader reader, SensorViewTable& table)
+{
+    uint32_t field, wiretype;
+    COSMPWireReader sub;
+    bool has_host_vehicle_id;
+    while (reader.next(field, wiretype)) {
+        bool ok;
+        if (wiretype != OSMP_WIRETYPE_LENGTH_DELIMITED)
+            ok = reader.skip(wiretype);
+        else if (field == osi3::GroundTruth::kHostVehicleIdFieldNumber)
+            ok = reader.read_message(sub) && scan_identifier(sub,has_host_vehicle_id,table.host_vehicle_id);
+        else if (field == osi3::GroundTruth::kMovingObjectFieldNumber) {
+            table.moving_objects.push_back(SensorViewMovingObject());
+            ok = reader.read_message(sub) && scan_moving_object(sub,table.moving_objects.back());
+            if (ok)
+                table.moving_object_index.insert(table.moving_objects.back().id,table.moving_objects.size()-1);
+        } else
+            ok = reader.skip(wiretype);
+        if (!ok)
+            return false;
+    }
+    return !reader.error();
+}
+
+static bool scan_sensor_view(COSMPWireReader reader, SensorViewTable& table)
+{
+    uint32_t field, wiretype;
+    COSMPWireReader sub;
+    while (reader.next(field, wiretype)) {
+        bool ok;
+        if (wiretype != OSMP_WIRETYPE_LENGTH_DELIMITED)
+            ok = reader.skip(wiretype);
+        else if (field == osi3::SensorView::kSensorIdFieldNumber)
+            ok = reader.read_message(sub) && scan_identifier(sub,table.has_sensor_id,table.sensor_id);
+        else if (field == osi3::SensorView::kGlobalGroundTruthFieldNumber)
+            ok = reader.read_message(sub) && scan_ground_truth(sub,table);
+        else
+            ok = reader.skip(wiretype);
+        if (!ok)
+            return false;
+    }
+    return !reader.error();
+}
+
+/* Runs on the decoding threads, so it must not log */
+bool COSMPDummySensor::scan_fmi_sensor_view_in(int input, SensorViewTable& table)
+{
+    table.has_sensor_id = false;
+    table.sensor_id = 0;
+    table.host_vehicle_id = 0;
+    table.moving_objects.clear();
+    table.moving_object_index.clear();
+    fmi2Integer size = fmi_sensor_view_in_size(input);
+    if (size > 0)
+        return scan_sensor_view(COSMPWireReader(fmi_sensor_view_in_buffer(input),size),table);
+    else
+        return false;
+}
+
+/*
+ * Concurrent Input Decoding
+ *
+ * Each input is scanned (and, for passthrough by copy, fully decoded)
+ * as a task of its own on the thread pool, into state private to
+ * that input.  Everything that may log or touch shared state happens
+ * on the calling thread before and after the batch.
+ */
+
+template<class Profile>
+void COSMPDummySensor::decode_fmi_sensor_view_in(int input)
+{
+    SensorViewInput& in = sensorViewInputs[input];
+    OSMPAllocationCount before = osmp_allocation_count();
+    in.valid = scan_fmi_sensor_view_in(input,in.table);
+    if (in.valid) {
+        const COSMPCountedVector<SensorViewMovingObject>& objects = in.table.moving_objects;
+        in.grid.begin_update();
+        for (size_t k = 0; k < objects.size(); k++)
+            in.grid.update(objects[k].id,(uint32_t)k,objects[k].x,objects[k].y);
+        in.grid.end_update();
+        /* Only objects within range of the host vehicle can be detected */
+        size_t ego = in.table.moving_object_index.find(in.table.host_vehicle_id);
+        if (ego != COSMPIdIndex::npos)
+            in.grid.query(objects[ego].x,objects[ego].y,Profile::range(),in.candidates);
+        else
+            in.grid.query(0.0,0.0,Profile::range(),in.candidates);
+        in.columns.resize(in.candidates.size());
+        for (size_t k = 0; k < in.candidates.size(); k++) {
+            const SensorViewMovingObject& obj = objects[in.candidates[k]];
+            in.columns.set_pose(k,obj.id,obj.x,obj.y,obj.z,obj.yaw,obj.pitch,obj.roll);
+        }
+        osmp_orient_objects(in.columns,in.rotations);
+    }
+    const OSMPAllocationCount& after = osmp_allocation_count();
+    in.scanAllocations = (fmi2Integer)min(after.allocations - before.allocations,(uint64_t)INT32_MAX);
+    in.scanBytes += after.bytes - before.bytes;
+    if (in.valid && fmi_sensor_view_passthrough() == SENSORVIEW_PASSTHROUGH_COPY)
+        get_fmi_sensor_view_in(input,*in.view);
+}
+
+void COSMPDummySensor::start_fmi_sensor_view_ins_decode()
+{
+    bool copy = (fmi_sensor_view_passthrough() == SENSORVIEW_PASSTHROUGH_COPY);
+    for (int input = 0; input < SENSORVIEW_INPUTS; input++) {
+        if (fmi_sensor_view_in_size(input) > 0) {
+            int idx = fmi_sensor_view_in_idx(input);
+            normal_log("OSMP","Got %08X %08X, scanning input %d from %p ...",integer_vars[idx+1],integer_vars[idx],input+1,fmi_sensor_view_in_buffer(input));
+        }
+        if (copy)
+            reset_fmi_sensor_view_in(input);
+    }
+    threadPool.start(SENSORVIEW_INPUTS,sensorViewDecodeTask);
+    sensorViewDecodePending = true;
+}
+
+int COSMPDummySensor::finish_fmi_sensor_view_ins_decode()
+{
+    bool copy = (fmi_sensor_view_passthrough() == SENSORVIEW_PASSTHROUGH_COPY);
+    threadPool.wait();
+    sensorViewDecodePending = false;
+    int valid = 0;
+    /* Scan state is kept for invalid inputs too, so it is always counted */
+    int64_t allocations = 0, bytes = 0;
+    for (int input = 0; input < SENSORVIEW_INPUTS; input++) {
+        const SensorViewInput& in = sensorViewInputs[input];
+        allocations += in.scanAllocations;
+        bytes += in.scanBytes;
+        if (in.valid) {
+            valid++;
+            if (copy) {
+                allocations += in.decodeAllocations;
+                bytes += in.decodeBytes;
+            }
+        } else if (fmi_sensor_view_in_size(input) > 0) {
+            normal_log("OSMP","Malformed SensorView input %d, ignoring it.",input+1);
+        }
+    }
+    set_fmi_decode_allocations((fmi2Integer)min(allocations,(int64_t)INT32_MAX));
+    set_fmi_decode_bytes((fmi2Integer)min(bytes,(int64_t)INT32_MAX));
+    normal_log("OSMP","Decoded with %d allocations, %d bytes reserved",fmi_decode_allocations(),fmi_decode_bytes());
+    return valid;
+}
+
+int COSMPDummySensor::decode_fmi_sensor_view_ins()
+{
+    start_fmi_sensor_view_ins_decode();
+    return finish_fmi_sensor_view_ins_decode();
+}
+
+/*
+ * Eager Decoding
+ *
+ * If the eagerDecoding parameter is set, decoding starts on the
+ * thread pool as soon as a complete base.lo/base.hi/size triple has
+ * been set for every input, so that it overlaps with whatever the
+ * master does before calling fmi2DoStep.  Setting an input again while
+ * decoding is under way waits for it and drops its result, so the
+ * step always works on the inputs as finally set.
+ */
+
+void COSMPDummySensor::commit_fmi_sensor_view_in(fmi2ValueReference vr)
+{
+    int input = fmi_sensor_view_in_of(vr);
+    if (input < 0)
+        return;
+    if (sensorViewDecodePending) {
+        finish_fmi_sensor_view_ins_decode();
+        normal_log("OSMP","Input %d set again while decoding, dropping eager decoding result.",input+1);
+    }
+    sensorViewInputs[input].committed |= 1u << fmi_sensor_view_in_role(vr);
+}
+
+void COSMPDummySensor::start_fmi_sensor_view_ins_eager_decode()
+{
+    if (!fmi_eager_decoding() || sensorViewDecodePending || threadPool.workers() == 0)
+        return;
+    for (int input = 0; input < SENSORVIEW_INPUTS; input++)
+        if (sensorViewInputs[input].committed != 7u)
+            return;
+    normal_log("OSMP","All inputs set, starting eager decoding.");
+    for (int input = 0; input < SENSORVIEW_INPUTS; input++)
+        sensorViewInputs[input].committed = 0;
+    start_fmi_sensor_view_ins_decode();
+}
+
+/*
+ * Unchanged Input Detection
+ *
+ * Masters stepping the sensor faster than its source refreshes will
+ * pass the same SensorView several times in a row.  In that case the
+ * previous output is published again instead of recalculating it.
+ * Content is compared through a fast 64bit hash; in identity mode an
+ * unchanged buffer address and size is trusted to mean unchanged
+ * content, which requires the master not to rewrite buffers in place.
+ */
+
+static inline uint64_t hash_mix(uint64_t h, uint64_t v)
+{
+    h ^= v * 0x87C37B91114253D5ULL;
+    h = (h << 31) | (h >> 33);
+    return h * 0x4CF5AD432745937FULL;
+}
+
+static uint64_t hash_buffer(const void* data, size_t size)
+{
+    const uint8_t* p = static_cast<const uint8_t*>(data);
+    uint64_t h0 = 0x9E3779B97F4A7C15ULL ^ size, h1 = 0xC2B2AE3D27D4EB4FULL, h2 = 0x165667B19E3779F9ULL, h3 = 0x27D4EB2F165667C5ULL;
+    uint64_t v[4];
+    /* Four independent lanes keep the multipliers busy */
+    for (; size >= 32; p += 32, size -= 32) {
+        memcpy(v, p, 32);
+        h0 = hash_mix(h0, v[0]);
+        h1 = hash_mix(h1, v[1]);
+        h2 = hash_mix(h2, v[2]);
+        h3 = hash_mix(h3, v[3]);
+    }
+    for (; size >= 8; p += 8, size -= 8) {
+        memcpy(v, p, 8);
+        h0 = hash_mix(h0, v[0]);
+    }
+    v[0] = 0;
+    memcpy(v, p, size);
+    h0 = hash_mix(h0, v[0]);
+    uint64_t h = h0 ^ ((h1 << 17) | (h1 >> 47)) ^ ((h2 << 29) | (h2 >> 35)) ^ ((h3 << 43) | (h3 >> 21));
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDULL;
+    h ^= h >> 33;
+    h *= 0xC4CEB9FE1A85EC53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+bool COSMPDummySensor::check_fmi_sensor_view_in_unchanged()
+{
+    bool unchanged = (fmi_unchanged_input_detection() != UNCHANGED_INPUT_DETECTION_OFF);
+    for (int input = 0; input < SENSORVIEW_INPUTS; input++)
+        if (fmi_sensor_view_in_size(input) <= 0)
+            unchanged = false;
+    if (unchanged) {
+        /* Inputs are hashed concurrently, just like they are decoded */
+        bool identity = (fmi_unchanged_input_detection() == UNCHANGED_INPUT_DETECTION_IDENTITY);
+        auto check = [this, identity](size_t input) {
+            SensorViewInput& in = sensorViewInputs[input];
+            fmi2Integer size = fmi_sensor_view_in_size((int)input);
+            const void* buffer = fmi_sensor_view_in_buffer((int)input);
+            in.unchanged = in.lastValid && size == in.lastSize;
+            if (in.unchanged && identity && buffer == in.lastBuffer)
+                return;
+            uint64_t hash = hash_buffer(buffer,size);
+            in.unchanged = in.unchanged && hash == in.lastHash;
+            in.lastBuffer = buffer;
+            in.lastSize = size;
+            in.lastHash = hash;
+        };
+        threadPool.run(SENSORVIEW_INPUTS,check);
+        for (int input = 0; input < SENSORVIEW_INPUTS; input++)
+            unchanged = unchanged && sensorViewInputs[input].unchanged;
+    }
+    /* A changed input only becomes valid once an output was calculated from it */
+    for (int input = 0; input < SENSORVIEW_INPUTS; input++)
+        sensorViewInputs[input].lastValid = unchanged;
+    return unchanged;
+}
+
+/* Runs on the serialization threads, so it must not log */
+bool COSMPDummySensor::set_fmi_sensor_data_out(int output, const osi3::SensorData& data, const uint8_t*& written, bool splice_sensor_view_in)
+{
+#if GOOGLE_PROTOBUF_VERSION >= 3001000
+    size_t size = data.ByteSizeLong();
+#else
+    size_t size = data.ByteSize();
+#endif
+    size += sensorDataHeaders[output].size();
+    for (size_t chunk = outputChunks[output]; chunk < outputChunks[output+1]; chunk++)
+        size += detectionChunks[chunk].encoded.size();
+    if (splice_sensor_view_in)
+        for (int input = 0; input < SENSORVIEW_INPUTS; input++)
+            if (sensorViewInputs[input].valid)
+                size += wire_length_delimited_size(osi3::SensorData::kSensorViewFieldNumber,fmi_sensor_view_in_size(input));
+#ifdef SHARED_MEMORY_TRANSPORT
+    OSMPSharedMemorySlot& currentSlot = outputSlots[output][outputBufferIndex];
+    uint8_t* buffer = outputRegion.begin_write(currentSlot,size);
+    if (buffer == NULL)
+        return false;
+#else
+    string& currentBuffer = outputBuffers[output][outputBufferIndex];
+    /* Buffers only ever grow, so steady state serialization does not reallocate */
+    if (currentBuffer.size() < size)
+        currentBuffer.resize(size);
+    uint8_t* buffer = reinterpret_cast<uint8_t*>(&currentBuffer[0]);
+#endif
+    /* Header first, all fields of the message have higher numbers */
+    memcpy(buffer,sensorDataHeaders[output].data(),sensorDataHeaders[output].size());
+    uint8_t* target = data.SerializeWithCachedSizesToArray(buffer+sensorDataHeaders[output].size());
+    /* Detected moving objects, encoded beforehand, follow all fields of lower number */
+    for (size_t chunk = outputChunks[output]; chunk < outputChunks[output+1]; chunk++) {
+        const COSMPWireWriter& encoded = detectionChunks[chunk].encoded;
+        if (encoded.size() > 0)
+            memcpy(target,encoded.data(),encoded.size());
+        target += encoded.size();
+    }
+    /* Encoded SensorViews appended verbatim as additional sensor_view entries */
+    if (splice_sensor_view_in)
+        for (int input = 0; input < SENSORVIEW_INPUTS; input++)
+            if (sensorViewInputs[input].valid)
+                target = wire_write_length_delimited(target,osi3::SensorData::kSensorViewFieldNumber,fmi_sensor_view_in_buffer(input),fmi_sensor_view_in_size(input));
+    int idx = fmi_sensor_data_out_idx(output);
+#ifdef SHARED_MEMORY_TRANSPORT
+    integer_vars[idx+1]=(fmi2Integer)outputRegion.end_write(currentSlot,size);
+    integer_vars[idx]=(fmi2Integer)currentSlot.offset;
+#else
+    encode_pointer_to_integer(buffer,integer_vars[idx+1],integer_vars[idx]);
+#endif
+    integer_vars[idx+2]=(fmi2Integer)size;
+    written = buffer;
+    return true;
+}
+
+/*
+ * Concurrent Output Serialization
+ *
+ * All outputs are serialized as tasks of their own on the thread pool,
+ * each into its own ring of buffers, so that the step only waits for
+ * the largest output.  The rings advance together.
+ */
+
+bool COSMPDummySensor::set_fmi_sensor_data_outs(bool splice_sensor_view_in)
 {
-    data.SerializeToString(&currentBuffer);
-    encode_pointer_to_integer(currentBuffer.data(),integer_vars[FMI_INTEGER_SENSORDATA_OUT_BASEHI_IDX],integer_vars[FMI_INTEGER_SENSORDATA_OUT_BASELO_IDX]);
-    integer_vars[FMI_INTEGER_SENSORDATA_OUT_SIZE_IDX]=(fmi2Integer)currentBuffer.length();
-    normal_log("OSMP","Providing %08X %08X, writing from %p ...",integer_vars[FMI_INTEGER_SENSORDATA_OUT_BASEHI_IDX],integer_vars[FMI_INTEGER_SENSORDATA_OUT_BASELO_IDX],currentBuffer.data());
-    swap(currentBuffer,lastBuffer);
+    bool written[SENSORDATA_OUTPUTS];
+    const uint8_t* buffers[SENSORDATA_OUTPUTS];
+    auto serialize = [this, splice_sensor_view_in, &written, &buffers](size_t output) {
+        written[output] = set_fmi_sensor_data_out((int)output,sensorDataOuts[output],buffers[output],splice_sensor_view_in);
+    };
+    threadPool.run(SENSORDATA_OUTPUTS,serialize);
+    bool ok = true;
+    for (int output = 0; output < SENSORDATA_OUTPUTS; output++) {
+        int idx = fmi_sensor_data_out_idx(output);
+        if (written[output]) {
+            normal_log("OSMP","Providing %08X %08X, writing output %d ...",integer_vars[idx+1],integer_vars[idx],output+1);
+            /* Recorded from this thread only, in output order */
+            if (traceRecorder.is_open() && !traceRecorder.record(buffers[output],(size_t)integer_vars[idx+2]))
+                normal_log("OSMP","Trace recording fell behind, dropped output %d",output+1);
+        } else {
+            normal_log("OSMP","No space left for output %d, providing no output.",output+1);
+            integer_vars[idx+2]=0;
+            integer_vars[idx+1]=0;
+            integer_vars[idx]=0;
+            ok = false;
+        }
+    }
+    outputBufferIndex = (outputBufferIndex + 1) % OUTPUT_BUFFER_DEPTH;
+    set_fmi_record_dropped((fmi2Integer)traceRecorder.dropped_frames());
+    return ok;
 }
 
-void COSMPDummySensor::reset_fmi_sensor_data_out()
+void COSMPDummySensor::reset_fmi_sensor_data_outs()
 {
-    integer_vars[FMI_INTEGER_SENSORDATA_OUT_SIZE_IDX]=0;
-    integer_vars[FMI_INTEGER_SENSORDATA_OUT_BASEHI_IDX]=0;
-    integer_vars[FMI_INTEGER_SENSORDATA_OUT_BASELO_IDX]=0;
+    for (int output = 0; output < SENSORDATA_OUTPUTS; output++) {
+        int idx = fmi_sensor_data_out_idx(output);
+        integer_vars[idx+2]=0;
+        integer_vars[idx+1]=0;
+        integer_vars[idx]=0;
+    }
 }
 
 /*
@@ -144,6 +645,23 @@ fmi2Status COSMPDummySensor::doInit()
     for (int i = 0; i<FMI_INTEGER_VARS; i++)
         integer_vars[i] = 0;
 
+    integer_vars[FMI_INTEGER_SENSORVIEW_PASSTHROUGH_IDX] = SENSORVIEW_PASSTHROUGH_SPLICE;
+    integer_vars[FMI_INTEGER_OCCLUSION_CULLING_IDX] = OCCLUSION_CULLING_OFF;
+
+    if (sensorViewDecodePending)
+        finish_fmi_sensor_view_ins_decode();
+    for (int input = 0; input < SENSORVIEW_INPUTS; input++) {
+        sensorViewInputs[input].valid = false;
+        sensorViewInputs[input].committed = 0;
+        sensorViewInputs[input].lastValid = false;
+        sensorViewInputs[input].lastBuffer = NULL;
+        sensorViewInputs[input].lastSize = 0;
+        sensorViewInputs[input].lastHash = 0;
+    }
+    for (int output = 0; output < SENSORDATA_OUTPUTS; output++)
+        for (int input = 0; input < SENSORVIEW_INPUTS; input++)
+            sensorTracks[output][input].clear();
+
     /* Reals */
     for (int i = 0; i<FMI_REAL_VARS; i++)
         real_vars[i] = 0.0;
@@ -152,6 +670,22 @@ fmi2Status COSMPDummySensor::doInit()
     for (int i = 0; i<FMI_STRING_VARS; i++)
         string_vars[i] = "";
 
+#ifdef SHARED_MEMORY_TRANSPORT
+    if (!outputRegion.is_open()) {
+        static std::atomic<unsigned int> regions(0);
+        char name[64];
+        snprintf(name,sizeof(name),"/OSMPDummySensor.%ld.%u",(long)getpid(),regions++);
+        if (!outputRegion.open(name,SHARED_MEMORY_SIZE)) {
+            normal_log("OSMP","Cannot create shared memory region %s",name);
+            return fmi2Error;
+        }
+        memset(outputSlots,0,sizeof(outputSlots));
+        normal_log("OSMP","Providing outputs in shared memory region %s",name);
+    }
+    for (int output = 0; output < SENSORDATA_OUTPUTS; output++)
+        string_vars[FMI_STRING_SENSORDATA_OUT_REGION_OFFSET+output] = outputRegion.name();
+#endif
+
     return fmi2OK;
 }
 
@@ -169,112 +703,330 @@ fmi2Status COSMPDummySensor::doEnterInitializationMode()
 
 fmi2Status COSMPDummySensor::doExitInitializationMode()
 {
+    /* The calling thread counts as one of the detection threads */
+    unsigned int workers = default_worker_count();
+    if (fmi_detection_threads() > 0)
+        workers = (unsigned int)fmi_detection_threads() - 1;
+    /* Eager decoding needs a worker even for a single input */
+    if (fmi_eager_decoding() && workers == 0)
+        workers = 1;
+    if (workers != threadPool.workers()) {
+        normal_log("OSMP","Using %u worker threads",workers);
+        threadPool.resize(workers);
+    }
+    traceRecorder.close();
+    if (!fmi_record_trace().empty()) {
+        if (!traceRecorder.open(fmi_record_trace(),TRACE_RECORDER_BUFFER)) {
+            normal_log("OSMP","Cannot record trace to %s",fmi_record_trace().c_str());
+            return fmi2Error;
+        }
+        normal_log("OSMP","Recording outputs to %s",fmi_record_trace().c_str());
+    }
     return fmi2OK;
 }
 
-void rotatePoint(double x, double y, double z,double yaw,double pitch,double roll,double &rx,double &ry,double &rz)
+/*
+ * Concurrent Detection
+ *
+ * Which objects are detected by which output, and in which order, is
+ * decided on the calling thread, which also assigns their tracking
+ * ids.  Encoding the detected objects is then split into chunks for
+ * the thread pool, so that the output is bitwise identical however
+ * many threads take part.  Detected objects are streamed directly in
+ * wire format instead of being built as messages first; the encoded
+ * chunks of an output are copied behind the rest of its SensorData on
+ * serialization, giving the same bytes as the message tree would.
+ */
+
+/* Runs on the detection threads, so it must not log */
+template<class Profile>
+void COSMPDummySensor::encode_detected_moving_object(SensorDetection& detection, double time, COSMPWireWriter& out)
 {
-    double matrix[3][3];
-    double cos_yaw = cos(yaw);
-    double cos_pitch = cos(pitch);
-    double cos_roll = cos(roll);
-    double sin_yaw = sin(yaw);
-    double sin_pitch = sin(pitch);
-    double sin_roll = sin(roll);
+    typedef osi3::DetectedItemHeader Header;
+    typedef osi3::DetectedMovingObject::CandidateMovingObject Candidate;
+    const SensorViewInput& in = sensorViewInputs[detection.input];
+    const SensorViewTable& table = in.table;
+    const SensorViewMovingObject& veh = table.moving_objects[in.candidates[detection.candidate]];
+    double distance = in.columns.column(COSMPObjectColumns::DISTANCE)[detection.candidate];
+    detection.existence_probability = Profile::Probability::existence(distance)*detection.visibility;
+    detection.x = veh.x;
+    detection.y = veh.y;
+    detection.z = veh.z;
+    Profile::Noise::apply(veh.id,time,detection.x,detection.y,detection.z);
+
+    size_t object = out.begin_message(osi3::SensorData::kMovingObjectFieldNumber);
+    size_t header = out.begin_message(osi3::DetectedMovingObject::kHeaderFieldNumber);
+    size_t id = out.begin_message(Header::kTrackingIdFieldNumber);
+    out.write_varint(osi3::Identifier::kValueFieldNumber,detection.tracking_id);
+    out.end_message(id);
+    id = out.begin_message(Header::kGroundTruthIdFieldNumber);
+    if (veh.has_id)
+        out.write_varint(osi3::Identifier::kValueFieldNumber,veh.id);
+    out.end_message(id);
+    out.write_double(Header::kExistenceProbabilityFieldNumber,detection.existence_probability);
+    if (detection.has_age)
+        out.write_double(Header::kAgeFieldNumber,detection.age);
+    /* Fully occluded objects are only kept as predictions of their tracks */
+    out.write_varint(Header::kMeasurementStateFieldNumber,detection.visibility > 0.0 ? osi3::DetectedItemHeader_MeasurementState_MEASUREMENT_STATE_MEASURED : osi3::DetectedItemHeader_MeasurementState_MEASUREMENT_STATE_PREDICTED);
+    id = out.begin_message(Header::kSensorIdFieldNumber);
+    if (table.has_sensor_id)
+        out.write_varint(osi3::Identifier::kValueFieldNumber,table.sensor_id);
+    out.end_message(id);
+    out.end_message(header);
+
+    size_t base = out.begin_message(osi3::DetectedMovingObject::kBaseFieldNumber);
+    size_t vector = out.begin_message(osi3::BaseMoving::kDimensionFieldNumber);
+    out.write_double(osi3::Dimension3d::kLengthFieldNumber,veh.length);
+    out.write_double(osi3::Dimension3d::kWidthFieldNumber,veh.width);
+    out.write_double(osi3::Dimension3d::kHeightFieldNumber,veh.height);
+    out.end_message(vector);
+    vector = out.begin_message(osi3::BaseMoving::kPositionFieldNumber);
+    out.write_double(osi3::Vector3d::kXFieldNumber,detection.x);
+    out.write_double(osi3::Vector3d::kYFieldNumber,detection.y);
+    out.write_double(osi3::Vector3d::kZFieldNumber,detection.z);
+    out.end_message(vector);
+    if (detection.has_velocity) {
+        vector = out.begin_message(osi3::BaseMoving::kVelocityFieldNumber);
+        out.write_double(osi3::Vector3d::kXFieldNumber,detection.velocity_x);
+        out.write_double(osi3::Vector3d::kYFieldNumber,detection.velocity_y);
+        out.write_double(osi3::Vector3d::kZFieldNumber,detection.velocity_z);
+        out.end_message(vector);
+    }
+    out.end_message(base);
+
+    size_t candidate = out.begin_message(osi3::DetectedMovingObject::kCandidateFieldNumber);
+    out.write_double(Candidate::kProbabilityFieldNumber,1.0);
+    out.write_varint(Candidate::kTypeFieldNumber,(uint64_t)(int64_t)veh.type);
+    /* Copied verbatim from the input */
+    out.write_bytes(Candidate::kVehicleClassificationFieldNumber,veh.vehicle_classification,veh.vehicle_classification_size);
+    out.end_message(candidate);
+    out.end_message(object);
+}
 
-    matrix[0][0] = cos_yaw*cos_pitch;  matrix[0][1]=cos_yaw*sin_pitch*sin_roll - sin_yaw*cos_roll; matrix[0][2]=cos_yaw*sin_pitch*cos_roll + sin_yaw*sin_roll;
-    matrix[1][0] = sin_yaw*cos_pitch;  matrix[1][1]=sin_yaw*sin_pitch*sin_roll + cos_yaw*cos_roll; matrix[1][2]=sin_yaw*sin_pitch*cos_roll - cos_yaw*sin_roll;
-    matrix[2][0] = -sin_pitch;         matrix[2][1]=cos_pitch*sin_roll;                            matrix[2][2]=cos_pitch*cos_roll;
+/*
+ * Half axes, along its length and width, of the bounding box of object
+ * k in the relative coordinates of osmp_transform_objects, which turn
+ * every object by its own orientation: the box, already turned by that
+ * orientation, is turned by it once more.
+ */
+static void relative_box_axes(const COSMPObjectColumns& columns, uint32_t k, double length, double width, double& length_x, double& length_y, double& width_x, double& width_y)
+{
+    typedef COSMPObjectColumns C;
+    double m00 = columns.column(C::M00)[k], m01 = columns.column(C::M01)[k], m02 = columns.column(C::M02)[k];
+    double m10 = columns.column(C::M10)[k], m11 = columns.column(C::M11)[k], m12 = columns.column(C::M12)[k];
+    double m20 = columns.column(C::M20)[k], m21 = columns.column(C::M21)[k];
+    length_x = (m00*m00 + m01*m10 + m02*m20)*length/2;
+    length_y = (m10*m00 + m11*m10 + m12*m20)*length/2;
+    width_x = (m00*m01 + m01*m11 + m02*m21)*width/2;
+    width_y = (m10*m01 + m11*m11 + m12*m21)*width/2;
+}
 
-    rx = matrix[0][0] * x + matrix[0][1] * y + matrix[0][2] * z;
-    ry = matrix[1][0] * x + matrix[1][1] * y + matrix[1][2] * z;
-    rz = matrix[2][0] * x + matrix[2][1] * y + matrix[2][2] * z;
+/* Selects the detections of every output, in output order, and encodes them */
+template<class Profile>
+void COSMPDummySensor::detect_moving_objects(double time)
+{
+    /* Mounting directions of the outputs */
+    double mounting_cos[SENSORDATA_OUTPUTS], mounting_sin[SENSORDATA_OUTPUTS];
+    for (int output = 0; output < SENSORDATA_OUTPUTS; output++) {
+        double mounting_yaw = 2.0*acos(-1.0)*output/SENSORDATA_OUTPUTS;
+        mounting_cos[output] = cos(mounting_yaw);
+        mounting_sin[output] = sin(mounting_yaw);
+
+        /* Clear Output, only copies of the inputs are still built as messages */
+        sensorDataOuts[output].Clear();
+        /* Version and Timestamp */
+        sensorDataHeaders[output].clear();
+        sensorDataStaticHeader.write(sensorDataHeaders[output],time);
+    }
+
+    /* Only set for valid inputs, zeroed so that the compiler need not prove that only those are read */
+    uint64_t ego_ids[SENSORVIEW_INPUTS] = {};
+    double ego_x[SENSORVIEW_INPUTS] = {}, ego_y[SENSORVIEW_INPUTS] = {}, ego_z[SENSORVIEW_INPUTS] = {};
+    for (int input = 0; input < SENSORVIEW_INPUTS; input++) {
+        SensorViewInput& in = sensorViewInputs[input];
+        if (!in.valid)
+            continue;
+        const SensorViewTable& table = in.table;
+        ego_x[input] = ego_y[input] = ego_z[input] = 0;
+        uint64_t ego_id = ego_ids[input] = table.host_vehicle_id;
+        normal_log("OSI","Looking for EgoVehicle with ID: %d in input %d",ego_id,input+1);
+        size_t ego = table.moving_object_index.find(ego_id);
+        if (ego != COSMPIdIndex::npos) {
+            const SensorViewMovingObject& obj = table.moving_objects[ego];
+            normal_log("OSI","Found EgoVehicle with ID: %d",obj.id);
+            ego_x[input] = obj.x;
+            ego_y[input] = obj.y;
+            ego_z[input] = obj.z;
+        }
+        normal_log("OSI","Current Ego Position: %f,%f,%f", ego_x[input], ego_y[input], ego_z[input]);
+
+        /* Copy of SensorView, spliced variant is appended on serialization */
+        if (fmi_sensor_view_passthrough() == SENSORVIEW_PASSTHROUGH_COPY)
+            for (int output = 0; output < SENSORDATA_OUTPUTS; output++)
+                sensorDataOuts[output].add_sensor_view()->CopyFrom(*in.view);
+
+        // NOTE: We currently do not take sensor mounting position into account,
+        // i.e. sensor-relative coordinates are relative to center of bounding box
+        // of ego vehicle currently.
+        /* Relative positions of all objects near the host vehicle at once */
+        osmp_transform_objects(in.columns,ego_x[input],ego_y[input],ego_z[input]);
+    }
+
+    /* Objects in scope of each output, in the order they are output in */
+    detections.clear();
+    size_t outputDetections[SENSORDATA_OUTPUTS+1];
+    for (int output = 0; output < SENSORDATA_OUTPUTS; output++) {
+        outputDetections[output] = detections.size();
+        for (int input = 0; input < SENSORVIEW_INPUTS; input++) {
+            SensorViewInput& in = sensorViewInputs[input];
+            if (!in.valid)
+                continue;
+            const SensorViewTable& table = in.table;
+            COSMPTrackTable& tracks = sensorTracks[output][input];
+            tracks.begin_frame();
+            size_t selected = osmp_cull_cone(in.columns,mounting_cos[output],mounting_sin[output],Profile::range(),Profile::min_cos());
+            normal_log("OSI","%zu of %zu vehicles (%zu near) of input %d in scope of output %d",selected,table.moving_objects.size(),in.columns.size(),input+1,output+1);
+            /*
+             * Bounding boxes of the objects near the host vehicle as seen
+             * from it, to find the objects in scope hidden behind nearer
+             * ones, in the same relative coordinates as the cone was culled
+             * in.  Objects out of scope still hide others, as their boxes
+             * may reach into the field of view.
+             */
+            bool occluding = (fmi_occlusion_culling() != OCCLUSION_CULLING_OFF);
+            if (occluding) {
+                occlusion.begin(acos(Profile::min_cos()));
+                const uint32_t* scope = in.columns.selected();
+                size_t s = 0;
+                for (uint32_t k = 0; k < (uint32_t)in.columns.size(); k++) {
+                    bool in_scope = s < selected && scope[s] == k;
+                    if (in_scope)
+                        s++;
+                    const SensorViewMovingObject& veh = table.moving_objects[in.candidates[k]];
+                    if (veh.id == ego_ids[input])
+                        continue;
+                    double length_x, length_y, width_x, width_y;
+                    relative_box_axes(in.columns,k,veh.length,veh.width,length_x,length_y,width_x,width_y);
+                    double lo, hi, nearest, farthest;
+                    osmp_box_span(in.columns.column(COSMPObjectColumns::REL_X)[k],in.columns.column(COSMPObjectColumns::REL_Y)[k],length_x,length_y,width_x,width_y,mounting_cos[output],mounting_sin[output],lo,hi,nearest,farthest);
+                    if (in_scope)
+                        occlusion.add(lo,hi,nearest,farthest);
+                    else
+                        occlusion.add_occluder(lo,hi,farthest);
+                }
+                occlusion.resolve();
+            }
+            size_t span = 0, occluded = 0;
+            for (size_t s = 0; s < selected; s++) {
+                uint32_t k = in.columns.selected()[s];
+                const SensorViewMovingObject& veh = table.moving_objects[in.candidates[k]];
+                if (veh.id == ego_ids[input]) {
+                    normal_log("OSI","Ignoring EGO Vehicle [%d] Relative Position: %f,%f,%f (%f,%f,%f)",veh.id,veh.x-ego_x[input],veh.y-ego_y[input],veh.z-ego_z[input],veh.x,veh.y,veh.z);
+                    continue;
+                }
+                double visibility = occluding ? occlusion.visibility(span++) : 1.0;
+                if (visibility == 0.0) {
+                    occluded++;
+                    if (fmi_occlusion_culling() == OCCLUSION_CULLING_DROP)
+                        continue;
+                }
+                SensorDetection detection;
+                detection.input = input;
+                detection.candidate = k;
+                /* Objects without an id, or sharing one with an object already tracked, get an id of their own */
+                size_t track = veh.has_id ? tracks.update(veh.id,time,veh.x,veh.y,veh.z) : COSMPTrackTable::npos;
+                uint64_t tracking_id = track != COSMPTrackTable::npos ? tracks.tracking_id(track) : tracks.untracked_id();
+                /* Tracking ids of the inputs are interleaved, so that they are unique per output */
+                detection.tracking_id = tracking_id*SENSORVIEW_INPUTS + input;
+                detection.has_age = false;
+                detection.has_velocity = false;
+                if (fmi_track_kinematics() && track != COSMPTrackTable::npos) {
+                    detection.has_age = true;
+                    detection.age = time - tracks.first_time(track);
+                    /* Average velocity over the history of the track */
+                    size_t history = tracks.history_size(track);
+                    const OSMPTrackSample& latest = tracks.sample(track,0);
+                    const OSMPTrackSample& oldest = tracks.sample(track,history-1);
+                    detection.has_velocity = history > 1 && latest.time > oldest.time;
+                    if (detection.has_velocity) {
+                        double elapsed = latest.time - oldest.time;
+                        detection.velocity_x = (latest.x - oldest.x)/elapsed;
+                        detection.velocity_y = (latest.y - oldest.y)/elapsed;
+                        detection.velocity_z = (latest.z - oldest.z)/elapsed;
+                    }
+                }
+                detection.visibility = visibility;
+                detections.push_back(detection);
+            }
+            tracks.end_frame();
+            if (occluded > 0)
+                normal_log("OSI","%zu vehicles of input %d fully occluded for output %d",occluded,input+1,output+1);
+        }
+    }
+
+    outputDetections[SENSORDATA_OUTPUTS] = detections.size();
+
+    /* Detections are independent of each other, so they are encoded concurrently */
+    size_t chunks = 0;
+    for (int output = 0; output < SENSORDATA_OUTPUTS; output++) {
+        outputChunks[output] = chunks;
+        for (size_t begin = outputDetections[output]; begin < outputDetections[output+1]; begin += DETECTION_CHUNK_SIZE) {
+            if (chunks == detectionChunks.size())
+                detectionChunks.push_back(SensorDetectionChunk());
+            SensorDetectionChunk& chunk = detectionChunks[chunks++];
+            chunk.begin = begin;
+            chunk.end = min(outputDetections[output+1], begin+DETECTION_CHUNK_SIZE);
+        }
+    }
+    outputChunks[SENSORDATA_OUTPUTS] = chunks;
+    auto encode = [this,time](size_t c) {
+        SensorDetectionChunk& chunk = detectionChunks[c];
+        chunk.encoded.clear();
+        for (size_t d = chunk.begin; d < chunk.end; d++)
+            encode_detected_moving_object<Profile>(detections[d],time,chunk.encoded);
+    };
+    threadPool.run(chunks,encode);
 }
 
 fmi2Status COSMPDummySensor::doCalc(fmi2Real currentCommunicationPoint, fmi2Real communicationStepSize, fmi2Boolean noSetFMUStatePriorToCurrentPointfmi2Component)
 {
     DEBUGBREAK();
-    osi3::SensorView currentIn;
-    osi3::SensorData currentOut;
     double time = currentCommunicationPoint+communicationStepSize;
     normal_log("OSI","Calculating Sensor at %f for %f (step size %f)",currentCommunicationPoint,time,communicationStepSize);
-    if (get_fmi_sensor_view_in(currentIn)) {
-        double ego_x=0, ego_y=0, ego_z=0;
-        osi3::Identifier ego_id = currentIn.global_ground_truth().host_vehicle_id();
-        normal_log("OSI","Looking for EgoVehicle with ID: %d",ego_id.value());
-        for_each(currentIn.global_ground_truth().moving_object().begin(),currentIn.global_ground_truth().moving_object().end(),
-            [this, ego_id, &ego_x, &ego_y, &ego_z](const osi3::MovingObject& obj) {
-                normal_log("OSI","MovingObject with ID %d is EgoVehicle: %d",obj.id().value(), obj.id().value() == ego_id.value());
-                if (obj.id().value() == ego_id.value()) {
-                    normal_log("OSI","Found EgoVehicle with ID: %d",obj.id().value());
-                    ego_x = obj.base().position().x();
-                    ego_y = obj.base().position().y();
-                    ego_z = obj.base().position().z();
-                }
-            });
-        normal_log("OSI","Current Ego Position: %f,%f,%f", ego_x, ego_y, ego_z);
-
-        /* Clear Output */
-        currentOut.Clear();
-        currentOut.mutable_version()->CopyFrom(osi3::InterfaceVersion::descriptor()->file()->options().GetExtension(osi3::current_interface_version));
-        /* Adjust Timestamps and Ids */
-        currentOut.mutable_timestamp()->set_seconds((long long int)floor(time));
-        currentOut.mutable_timestamp()->set_nanos((int)((time - floor(time))*1000000000.0));
-        /* Copy of SensorView */
-        currentOut.add_sensor_view()->CopyFrom(currentIn);
+    int decoded = -1;
+    if (sensorViewDecodePending)
+        decoded = finish_fmi_sensor_view_ins_decode();
+    for (int input = 0; input < SENSORVIEW_INPUTS; input++)
+        sensorViewInputs[input].committed = 0;
+    if (check_fmi_sensor_view_in_unchanged()) {
+        /* Output variables still refer to the previous output, which stays valid */
+        normal_log("OSI","Unchanged input, providing previous output again.");
+        set_fmi_unchanged_input_count(fmi_unchanged_input_count()+1);
+        return fmi2OK;
+    }
+    if (decoded < 0)
+        decoded = decode_fmi_sensor_view_ins();
+    if (decoded > 0) {
+        detect_moving_objects<SensorProfile>(time);
 
         int i=0;
-        for_each(currentIn.global_ground_truth().moving_object().begin(),currentIn.global_ground_truth().moving_object().end(),
-            [this,&i,&currentIn,&currentOut,ego_id,ego_x,ego_y,ego_z](const osi3::MovingObject& veh) {
-                if (veh.id().value() != ego_id.value()) {
-                    // NOTE: We currently do not take sensor mounting position into account,
-                    // i.e. sensor-relative coordinates are relative to center of bounding box
-                    // of ego vehicle currently.
-                    double trans_x = veh.base().position().x()-ego_x;
-                    double trans_y = veh.base().position().y()-ego_y;
-                    double trans_z = veh.base().position().z()-ego_z;
-                    double rel_x,rel_y,rel_z;
-                    rotatePoint(trans_x,trans_y,trans_z,veh.base().orientation().yaw(),veh.base().orientation().pitch(),veh.base().orientation().roll(),rel_x,rel_y,rel_z);
-                    double distance = sqrt(rel_x*rel_x + rel_y*rel_y + rel_z*rel_z);
-                    if ((distance <= 150.0) && (rel_x/distance > 0.866025)) {
-                        osi3::DetectedMovingObject *obj = currentOut.mutable_moving_object()->Add();
-                        obj->mutable_header()->add_ground_truth_id()->CopyFrom(veh.id());
-                        obj->mutable_header()->mutable_tracking_id()->set_value(i);
-                        obj->mutable_header()->set_existence_probability(cos((distance-75.0)/75.0));
-                        obj->mutable_header()->set_measurement_state(osi3::DetectedItemHeader_MeasurementState_MEASUREMENT_STATE_MEASURED);
-                        obj->mutable_header()->add_sensor_id()->CopyFrom(currentIn.sensor_id());
-                        obj->mutable_base()->mutable_position()->set_x(veh.base().position().x());
-                        obj->mutable_base()->mutable_position()->set_y(veh.base().position().y());
-                        obj->mutable_base()->mutable_position()->set_z(veh.base().position().z());
-                        obj->mutable_base()->mutable_dimension()->set_length(veh.base().dimension().length());
-                        obj->mutable_base()->mutable_dimension()->set_width(veh.base().dimension().width());
-                        obj->mutable_base()->mutable_dimension()->set_height(veh.base().dimension().height());
-                        
-                        osi3::DetectedMovingObject::CandidateMovingObject* candidate = obj->add_candidate();
-                        candidate->set_type(veh.type());
-                        candidate->mutable_vehicle_classification()->CopyFrom(veh.vehicle_classification());
-                        candidate->set_probability(1);
-                        
-                        normal_log("OSI","Output Vehicle %d[%d] Probability %f Relative Position: %f,%f,%f (%f,%f,%f)",i,veh.id().value(),obj->header().existence_probability(),rel_x,rel_y,rel_z,obj->base().position().x(),obj->base().position().y(),obj->base().position().z());
-                        i++;
-                    } else {
-                        normal_log("OSI","Ignoring Vehicle %d[%d] Outside Sensor Scope Relative Position: %f,%f,%f (%f,%f,%f)",i,veh.id().value(),veh.base().position().x()-ego_x,veh.base().position().y()-ego_y,veh.base().position().z()-ego_z,veh.base().position().x(),veh.base().position().y(),veh.base().position().z());
-                    }
-                }
-                else
-                {
-                    normal_log("OSI","Ignoring EGO Vehicle %d[%d] Relative Position: %f,%f,%f (%f,%f,%f)",i,veh.id().value(),veh.base().position().x()-ego_x,veh.base().position().y()-ego_y,veh.base().position().z()-ego_z,veh.base().position().x(),veh.base().position().y(),veh.base().position().z());
-                }
-            });
-        normal_log("OSI","Mapped %d vehicles to output", i);
+        for (size_t d = 0; d < detections.size(); d++, i++) {
+            const SensorDetection& detection = detections[d];
+            const SensorViewInput& in = sensorViewInputs[detection.input];
+            const COSMPObjectColumns& columns = in.columns;
+            normal_log("OSI","Output Vehicle %d[%d] Probability %f Relative Position: %f,%f,%f (%f,%f,%f)",i,in.table.moving_objects[in.candidates[detection.candidate]].id,detection.existence_probability,columns.column(COSMPObjectColumns::REL_X)[detection.candidate],columns.column(COSMPObjectColumns::REL_Y)[detection.candidate],columns.column(COSMPObjectColumns::REL_Z)[detection.candidate],detection.x,detection.y,detection.z);
+        }
+        normal_log("OSI","Mapped %d vehicles to outputs", i);
         /* Serialize */
-        set_fmi_sensor_data_out(currentOut);
-        set_fmi_valid(true);
-        set_fmi_count(currentOut.moving_object_size());
+        bool written = set_fmi_sensor_data_outs(fmi_sensor_view_passthrough() == SENSORVIEW_PASSTHROUGH_SPLICE);
+        for (int input = 0; input < SENSORVIEW_INPUTS; input++)
+            sensorViewInputs[input].lastValid = written && (fmi_unchanged_input_detection() != UNCHANGED_INPUT_DETECTION_OFF);
+        set_fmi_valid(written);
+        set_fmi_count(i);
     } else {
         /* We have no valid input, so no valid output */
         normal_log("OSI","No valid input, therefore providing no valid output.");
-        reset_fmi_sensor_data_out();
+        reset_fmi_sensor_data_outs();
         set_fmi_valid(false);
         set_fmi_count(0);
     }
@@ -284,6 +1036,10 @@ fmi2Status COSMPDummySensor::doCalc(fmi2Real currentCommunicationPoint, fmi2Real
 fmi2Status COSMPDummySensor::doTerm()
 {
     DEBUGBREAK();
+    if (traceRecorder.is_open()) {
+        traceRecorder.close();
+        normal_log("OSMP","Recorded %llu outputs, dropped %llu outputs (%llu bytes)%s",(unsigned long long)traceRecorder.recorded_frames(),(unsigned long long)traceRecorder.dropped_frames(),(unsigned long long)traceRecorder.dropped_bytes(),traceRecorder.write_failed() ? ", writing failed" : "");
+    }
     return fmi2OK;
 }
 
@@ -304,17 +1060,49 @@ COSMPDummySensor::COSMPDummySensor(fmi2String theinstanceName, fmi2Type thefmuTy
     functions(*thefunctions),
     visible(!!thevisible),
     loggingOn(!!theloggingOn),
-    last_time(0.0)
+    last_time(0.0),
+    outputBufferIndex(0),
+    sensorDataStaticHeader(osi3::SensorData::kVersionFieldNumber,osi3::SensorData::kTimestampFieldNumber),
+    threadPool(default_worker_count()),
+    sensorViewDecodePending(false),
+    occlusion(OCCLUSION_BINS)
 {
+    sensorViewDecodeTask.sensor = this;
+    for (int output = 0; output <= SENSORDATA_OUTPUTS; output++)
+        outputChunks[output] = 0;
+    for (int input = 0; input < SENSORVIEW_INPUTS; input++) {
+        sensorViewInputs[input].view = NULL;
+        sensorViewInputs[input].decodeAllocations = 0;
+        sensorViewInputs[input].decodeBytes = 0;
+        sensorViewInputs[input].scanAllocations = 0;
+        sensorViewInputs[input].scanBytes = 0;
+#ifdef ARENA_DECODING
+        sensorViewInputs[input].arena = NULL;
+#endif
+    }
     loggingCategories.clear();
     loggingCategories.insert("FMI");
     loggingCategories.insert("OSMP");
     loggingCategories.insert("OSI");
 }
 
-COSMPDummySensor::~COSMPDummySensor()
+/* One thread per input or output, as far as the hardware supports them */
+unsigned int COSMPDummySensor::default_worker_count()
 {
+    return min((unsigned int)max(SENSORVIEW_INPUTS,SENSORDATA_OUTPUTS), max(thread::hardware_concurrency(), 1u)) - 1;
+}
 
+COSMPDummySensor::~COSMPDummySensor()
+{
+    if (sensorViewDecodePending)
+        threadPool.wait();
+    for (int input = 0; input < SENSORVIEW_INPUTS; input++) {
+#ifdef ARENA_DECODING
+        delete sensorViewInputs[input].arena;
+#else
+        delete sensorViewInputs[input].view;
+#endif
+    }
 }
 
 
@@ -478,11 +1266,14 @@ fmi2Status COSMPDummySensor::SetInteger(const fmi2ValueReference vr[], size_t nv
 {
     fmi_verbose_log("fmi2SetInteger(...)");
     for (size_t i = 0; i<nvr; i++) {
-        if (vr[i]<FMI_INTEGER_VARS)
+        if (vr[i]<FMI_INTEGER_VARS) {
+            commit_fmi_sensor_view_in(vr[i]);
             integer_vars[vr[i]] = value[i];
+        }
         else
             return fmi2Error;
     }
+    start_fmi_sensor_view_ins_eager_decode();
     return fmi2OK;
 }
 
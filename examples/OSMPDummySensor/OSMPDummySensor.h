@@ -43,9 +43,45 @@ using namespace std;
 
 /* Boolean Variables */
 #define FMI_BOOLEAN_VALID_IDX 0
-#define FMI_BOOLEAN_LAST_IDX FMI_BOOLEAN_VALID_IDX
+#define FMI_BOOLEAN_EAGER_DECODING_IDX 1
+#define FMI_BOOLEAN_TRACK_KINEMATICS_IDX 2
+#define FMI_BOOLEAN_LAST_IDX FMI_BOOLEAN_TRACK_KINEMATICS_IDX
 #define FMI_BOOLEAN_VARS (FMI_BOOLEAN_LAST_IDX+1)
 
+/*
+ * SensorView Inputs
+ *
+ * SENSORVIEW_INPUTS gives the number of SensorView inputs of the
+ * sensor.  A single input is named OSMPSensorViewIn, several inputs
+ * are named OSMPSensorViewIn[1] to OSMPSensorViewIn[n] and decoded
+ * concurrently on an internal thread pool.  The first input keeps
+ * the variables below, all further inputs follow the other integer
+ * variables as three consecutive variables (base.lo, base.hi, size)
+ * each.
+ */
+#ifndef SENSORVIEW_INPUTS
+#define SENSORVIEW_INPUTS 1
+#endif
+#if SENSORVIEW_INPUTS < 1
+#error "SENSORVIEW_INPUTS must be at least 1"
+#endif
+
+/*
+ * SensorData Outputs
+ *
+ * SENSORDATA_OUTPUTS gives the number of SensorData outputs, named
+ * like the inputs.  Each output stands for a sensor mounted at the
+ * ego vehicle with an evenly spaced yaw angle, has buffers of its own
+ * and is serialized concurrently with the other outputs.  Further
+ * outputs follow the further inputs.
+ */
+#ifndef SENSORDATA_OUTPUTS
+#define SENSORDATA_OUTPUTS 1
+#endif
+#if SENSORDATA_OUTPUTS < 1
+#error "SENSORDATA_OUTPUTS must be at least 1"
+#endif
+
 /* Integer Variables */
 #define FMI_INTEGER_SENSORVIEW_IN_BASELO_IDX 0
 #define FMI_INTEGER_SENSORVIEW_IN_BASEHI_IDX 1
@@ -54,28 +90,262 @@ using namespace std;
 #define FMI_INTEGER_SENSORDATA_OUT_BASEHI_IDX 4
 #define FMI_INTEGER_SENSORDATA_OUT_SIZE_IDX 5
 #define FMI_INTEGER_COUNT_IDX 6
-#define FMI_INTEGER_LAST_IDX FMI_INTEGER_COUNT_IDX
+#define FMI_INTEGER_DECODE_ALLOCATIONS_IDX 7
+#define FMI_INTEGER_DECODE_BYTES_IDX 8
+#define FMI_INTEGER_SENSORVIEW_PASSTHROUGH_IDX 9
+#define FMI_INTEGER_UNCHANGED_INPUT_DETECTION_IDX 10
+#define FMI_INTEGER_UNCHANGED_INPUT_COUNT_IDX 11
+#define FMI_INTEGER_DETECTION_THREADS_IDX 12
+#define FMI_INTEGER_OCCLUSION_CULLING_IDX 13
+#define FMI_INTEGER_RECORD_DROPPED_IDX 14
+#define FMI_INTEGER_SENSORVIEW_IN_EXTRA_OFFSET (FMI_INTEGER_RECORD_DROPPED_IDX+1)
+#define FMI_INTEGER_SENSORVIEW_IN_EXTRA_SIZE (3*(SENSORVIEW_INPUTS-1))
+#define FMI_INTEGER_SENSORDATA_OUT_EXTRA_OFFSET (FMI_INTEGER_SENSORVIEW_IN_EXTRA_OFFSET+FMI_INTEGER_SENSORVIEW_IN_EXTRA_SIZE)
+#define FMI_INTEGER_SENSORDATA_OUT_EXTRA_SIZE (3*(SENSORDATA_OUTPUTS-1))
+#define FMI_INTEGER_LAST_IDX (FMI_INTEGER_SENSORDATA_OUT_EXTRA_OFFSET+FMI_INTEGER_SENSORDATA_OUT_EXTRA_SIZE-1)
 #define FMI_INTEGER_VARS (FMI_INTEGER_LAST_IDX+1)
 
+/* SensorView Passthrough Modes (values of sensorViewPassthrough) */
+#define SENSORVIEW_PASSTHROUGH_OMIT 0
+#define SENSORVIEW_PASSTHROUGH_COPY 1
+#define SENSORVIEW_PASSTHROUGH_SPLICE 2
+
+/* Unchanged Input Detection Modes (values of unchangedInputDetection) */
+#define UNCHANGED_INPUT_DETECTION_OFF 0
+#define UNCHANGED_INPUT_DETECTION_HASH 1
+#define UNCHANGED_INPUT_DETECTION_IDENTITY 2
+
+/* Occlusion Culling Modes (values of occlusionCulling) */
+#define OCCLUSION_CULLING_OFF 0
+#define OCCLUSION_CULLING_DOWNGRADE 1
+#define OCCLUSION_CULLING_DROP 2
+
+/* Bins of the occlusion buffer over the opening angle of an output */
+#ifndef OCCLUSION_BINS
+#define OCCLUSION_BINS 1024
+#endif
+
+/*
+ * Sensor Profile
+ *
+ * SENSOR_PROFILE names the profile from OSMPSensorProfiles.h the
+ * detection core is specialized for: its range, opening angle and
+ * existence probability and noise policies.  It is set per FMU by
+ * CMakeLists.txt and defaults to the original dummy sensor.  The
+ * detection core, i.e. the grid query of the inputs and the culling,
+ * occlusion and encoding of the detections, takes the profile as
+ * template parameter; SensorProfile is only named where the FMU enters
+ * the core.
+ */
+#include "OSMPSensorProfiles.h"
+#ifndef SENSOR_PROFILE
+#define SENSOR_PROFILE COSMPDummySensorProfile
+#endif
+typedef SENSOR_PROFILE SensorProfile;
+
+/* Number of detections filled in as one task of the thread pool */
+#ifndef DETECTION_CHUNK_SIZE
+#define DETECTION_CHUNK_SIZE 64
+#endif
+
 /* Real Variables */
 #define FMI_REAL_LAST_IDX 0
 #define FMI_REAL_VARS (FMI_REAL_LAST_IDX+1)
 
 /* String Variables */
-#define FMI_STRING_LAST_IDX 0
+#define FMI_STRING_SENSORDATA_OUT_REGION_OFFSET 0
+#define FMI_STRING_SENSORDATA_OUT_REGION_SIZE SENSORDATA_OUTPUTS
+#define FMI_STRING_RECORD_TRACE_IDX (FMI_STRING_SENSORDATA_OUT_REGION_OFFSET+FMI_STRING_SENSORDATA_OUT_REGION_SIZE)
+#define FMI_STRING_LAST_IDX FMI_STRING_RECORD_TRACE_IDX
 #define FMI_STRING_VARS (FMI_STRING_LAST_IDX+1)
 
+/*
+ * Output Buffering
+ *
+ * OUTPUT_BUFFER_DEPTH gives the number of output buffers that are
+ * cycled through, i.e. a buffer provided at the end of one fmi2DoStep
+ * call stays valid until the beginning of the OUTPUT_BUFFER_DEPTH-th
+ * fmi2DoStep call after that.  The OSMP specification requires at
+ * least 2 (double buffering); deeper rings are advertised through the
+ * buffer-depth attribute of the binary variable annotations.
+ */
+#ifndef OUTPUT_BUFFER_DEPTH
+#define OUTPUT_BUFFER_DEPTH 2
+#endif
+#if OUTPUT_BUFFER_DEPTH < 2
+#error "OUTPUT_BUFFER_DEPTH must be at least 2"
+#endif
+
 #include <iostream>
 #include <fstream>
 #include <string>
 #include <cstdarg>
 #include <set>
+#include <vector>
 
 #undef min
 #undef max
 #include "osi_sensorview.pb.h"
 #include "osi_sensordata.pb.h"
 
+/*
+ * Arena Decoding
+ *
+ * If ARENA_DECODING is defined the SensorView input is decoded into
+ * a protocol buffer arena that lives as long as the FMU instance.
+ * The arena is rewound at the start of each step, and its initial
+ * block is grown to the high-water mark of previous steps, so that
+ * in steady state decoding does not touch the heap at all.  Arenas
+ * require Protocol Buffers 3.0 or later, older versions fall back to
+ * decoding into a reused heap-allocated message.  Only passthrough by
+ * copy decodes the input completely, the other modes merely scan it.
+ * The decode.allocations and decode.bytes outputs count the blocks of
+ * the arena together with the storage of the tables, grid and kernel
+ * columns the input is scanned into, which is counted through
+ * OSMPAllocationCounter.h, so that they apply to every mode.
+ */
+#ifdef ARENA_DECODING
+#if GOOGLE_PROTOBUF_VERSION >= 3000000
+#include <google/protobuf/arena.h>
+#ifndef ARENA_INITIAL_BLOCK_SIZE
+#define ARENA_INITIAL_BLOCK_SIZE 65536
+#endif
+#else
+#undef ARENA_DECODING
+#endif
+#endif
+
+#include "OSMPWireFormat.h"
+#include "OSMPStaticHeader.h"
+#include "OSMPThreadPool.h"
+#include "OSMPDetectionKernel.h"
+#include "OSMPIdIndex.h"
+#include "OSMPSpatialGrid.h"
+#include "OSMPTrackTable.h"
+#include "OSMPOcclusionBuffer.h"
+
+/*
+ * Shared Memory Transport
+ *
+ * If SHARED_MEMORY_TRANSPORT is defined the SensorData outputs are
+ * provided in a POSIX shared memory region private to the instance,
+ * instead of as pointers into the address space of the model, so that
+ * hosts running in another process can read them.  The region name
+ * is provided through the region variable of each output, base.lo and
+ * base.hi carry the offset of the buffer in the region and its
+ * generation.  SHARED_MEMORY_SIZE gives the maximum size of the
+ * region; only the part actually used is backed by memory.  Inputs
+ * are still passed as pointers.
+ */
+#ifdef SHARED_MEMORY_TRANSPORT
+#include "OSMPSharedMemory.h"
+#ifndef SHARED_MEMORY_SIZE
+#define SHARED_MEMORY_SIZE 268435456
+#endif
+#endif
+
+/*
+ * Trace Recording
+ *
+ * If the recordTrace parameter names a file, every SensorData output
+ * written is recorded to it as OSI trace, all outputs of a step in
+ * order; previous outputs provided again for unchanged input are not
+ * recorded twice.  The outputs are queued and written in the
+ * background, see OSMPTraceRecorder.h; TRACE_RECORDER_BUFFER gives the
+ * bytes queued at most, outputs that do not fit are dropped and
+ * counted in record.dropped.
+ */
+#include "OSMPTraceRecorder.h"
+#ifndef TRACE_RECORDER_BUFFER
+#define TRACE_RECORDER_BUFFER 67108864
+#endif
+
+/*
+ * Compact Input Tables
+ *
+ * The parts of the SensorView input the sensor actually works on, as
+ * scanned directly from the encoded input buffer.  Identifiers carry
+ * their own presence flags, so that they can be reproduced exactly
+ * in the output.
+ */
+struct SensorViewMovingObject {
+    bool has_id;
+    uint64_t id;
+    int type;
+    double x, y, z;
+    double length, width, height;
+    double yaw, pitch, roll;
+    /* Encoded VehicleClassification, pointing into the input buffer */
+    const uint8_t* vehicle_classification;
+    size_t vehicle_classification_size;
+};
+
+struct SensorViewTable {
+    bool has_sensor_id;
+    uint64_t sensor_id;
+    uint64_t host_vehicle_id;
+    COSMPCountedVector<SensorViewMovingObject> moving_objects;
+    /* Position in moving_objects by id, the last object wins for duplicate ids */
+    COSMPIdIndex moving_object_index;
+};
+
+/* Per-Input Decoding State */
+struct SensorViewInput {
+    /* Result of scanning the input in the current step */
+    bool valid;
+    SensorViewTable table;
+    /* Moving objects of the table near the host vehicle, by grid */
+    COSMPSpatialGrid grid;
+    COSMPCountedVector<uint32_t> candidates;
+    /* Poses of the candidates, for the detection kernel */
+    COSMPObjectColumns columns;
+    COSMPRotationCache rotations;
+    /* Roles (base.lo, base.hi, size) set since the last step, as bit mask */
+    unsigned int committed;
+    /* Fully decoded input, only used for SensorView passthrough by copy */
+    osi3::SensorView* view;
+    fmi2Integer decodeAllocations;
+    fmi2Integer decodeBytes;
+    /* Allocations of the scan state in the current step, and the bytes it holds */
+    fmi2Integer scanAllocations;
+    int64_t scanBytes;
+#ifdef ARENA_DECODING
+    google::protobuf::Arena* arena;
+    string arenaBlock;
+#endif
+    /* Fingerprint of the input the current output was calculated from */
+    bool unchanged;
+    bool lastValid;
+    const void* lastBuffer;
+    fmi2Integer lastSize;
+    uint64_t lastHash;
+};
+
+/* Detection of a candidate of an input by an output */
+struct SensorDetection {
+    int input;
+    /* Index into the detection kernel table of the input */
+    uint32_t candidate;
+    uint64_t tracking_id;
+    /* Time since the track was started, velocity estimated from its history */
+    bool has_age;
+    double age;
+    bool has_velocity;
+    double velocity_x, velocity_y, velocity_z;
+    /* Fraction of the object not occluded by nearer ones */
+    double visibility;
+    /* Values encoded, kept for logging */
+    double existence_probability;
+    double x, y, z;
+};
+
+/* Detections of one output encoded as one task of the thread pool */
+struct SensorDetectionChunk {
+    size_t begin, end;
+    /* Encoded moving_object fields of the SensorData output */
+    COSMPWireWriter encoded;
+};
+
 /* FMU Class */
 class COSMPDummySensor {
 public:
@@ -195,17 +465,84 @@ protected:
     fmi2Real real_vars[FMI_REAL_VARS];
     string string_vars[FMI_STRING_VARS];
     double last_time;
-    string currentBuffer;
-    string lastBuffer;
+#ifdef SHARED_MEMORY_TRANSPORT
+    COSMPSharedMemoryWriter outputRegion;
+    OSMPSharedMemorySlot outputSlots[SENSORDATA_OUTPUTS][OUTPUT_BUFFER_DEPTH];
+#else
+    string outputBuffers[SENSORDATA_OUTPUTS][OUTPUT_BUFFER_DEPTH];
+#endif
+    unsigned int outputBufferIndex;
+    osi3::SensorData sensorDataOuts[SENSORDATA_OUTPUTS];
+    /* Fields of the outputs encoded once per instance, and the headers encoded from them per step */
+    COSMPStaticHeader sensorDataStaticHeader;
+    COSMPWireWriter sensorDataHeaders[SENSORDATA_OUTPUTS];
+    SensorViewInput sensorViewInputs[SENSORVIEW_INPUTS];
+    COSMPThreadPool threadPool;
+    /* Decoding of all inputs as a batch for the thread pool */
+    struct SensorViewDecodeTask {
+        COSMPDummySensor* sensor;
+        void operator()(size_t input) const { sensor->decode_fmi_sensor_view_in<SensorProfile>((int)input); }
+    } sensorViewDecodeTask;
+    /* Decoding was started when the inputs were set, but not yet joined */
+    bool sensorViewDecodePending;
+    /* Detections of the current step, in output order */
+    vector<SensorDetection> detections;
+    /* Chunks of the detections, kept with their buffers across steps, and the first chunk of each output */
+    vector<SensorDetectionChunk> detectionChunks;
+    size_t outputChunks[SENSORDATA_OUTPUTS+1];
+    /* Tracks of the objects of each input detected by each output */
+    COSMPTrackTable sensorTracks[SENSORDATA_OUTPUTS][SENSORVIEW_INPUTS];
+    /* Occlusion of the objects in scope of the current output and input */
+    COSMPOcclusionBuffer occlusion;
+    COSMPTraceRecorder traceRecorder;
+#ifdef ARENA_DECODING
+    static void* sensor_view_in_arena_alloc(size_t size);
+    static void sensor_view_in_arena_dealloc(void* ptr, size_t size);
+#endif
 
     /* Simple Accessors */
     fmi2Boolean fmi_valid() { return boolean_vars[FMI_BOOLEAN_VALID_IDX]; }
     void set_fmi_valid(fmi2Boolean value) { boolean_vars[FMI_BOOLEAN_VALID_IDX]=value; }
+    fmi2Boolean fmi_eager_decoding() { return boolean_vars[FMI_BOOLEAN_EAGER_DECODING_IDX]; }
+    fmi2Boolean fmi_track_kinematics() { return boolean_vars[FMI_BOOLEAN_TRACK_KINEMATICS_IDX]; }
     fmi2Integer fmi_count() { return integer_vars[FMI_INTEGER_COUNT_IDX]; }
     void set_fmi_count(fmi2Integer value) { integer_vars[FMI_INTEGER_COUNT_IDX]=value; }
+    fmi2Integer fmi_decode_allocations() { return integer_vars[FMI_INTEGER_DECODE_ALLOCATIONS_IDX]; }
+    void set_fmi_decode_allocations(fmi2Integer value) { integer_vars[FMI_INTEGER_DECODE_ALLOCATIONS_IDX]=value; }
+    fmi2Integer fmi_decode_bytes() { return integer_vars[FMI_INTEGER_DECODE_BYTES_IDX]; }
+    void set_fmi_decode_bytes(fmi2Integer value) { integer_vars[FMI_INTEGER_DECODE_BYTES_IDX]=value; }
+    fmi2Integer fmi_sensor_view_passthrough() { return integer_vars[FMI_INTEGER_SENSORVIEW_PASSTHROUGH_IDX]; }
+    fmi2Integer fmi_unchanged_input_detection() { return integer_vars[FMI_INTEGER_UNCHANGED_INPUT_DETECTION_IDX]; }
+    fmi2Integer fmi_unchanged_input_count() { return integer_vars[FMI_INTEGER_UNCHANGED_INPUT_COUNT_IDX]; }
+    void set_fmi_unchanged_input_count(fmi2Integer value) { integer_vars[FMI_INTEGER_UNCHANGED_INPUT_COUNT_IDX]=value; }
+    fmi2Integer fmi_detection_threads() { return integer_vars[FMI_INTEGER_DETECTION_THREADS_IDX]; }
+    fmi2Integer fmi_occlusion_culling() { return integer_vars[FMI_INTEGER_OCCLUSION_CULLING_IDX]; }
+    void set_fmi_record_dropped(fmi2Integer value) { integer_vars[FMI_INTEGER_RECORD_DROPPED_IDX]=value; }
+    string fmi_record_trace() { return string_vars[FMI_STRING_RECORD_TRACE_IDX]; }
+
+    /* Binary Variable Accessors */
+    int fmi_sensor_view_in_idx(int input) { return input == 0 ? FMI_INTEGER_SENSORVIEW_IN_BASELO_IDX : FMI_INTEGER_SENSORVIEW_IN_EXTRA_OFFSET+3*(input-1); }
+    int fmi_sensor_view_in_of(fmi2ValueReference vr) { return vr <= FMI_INTEGER_SENSORVIEW_IN_SIZE_IDX ? 0 : (vr >= FMI_INTEGER_SENSORVIEW_IN_EXTRA_OFFSET && vr < FMI_INTEGER_SENSORVIEW_IN_EXTRA_OFFSET+FMI_INTEGER_SENSORVIEW_IN_EXTRA_SIZE) ? 1+(vr-FMI_INTEGER_SENSORVIEW_IN_EXTRA_OFFSET)/3 : -1; }
+    int fmi_sensor_view_in_role(fmi2ValueReference vr) { return vr <= FMI_INTEGER_SENSORVIEW_IN_SIZE_IDX ? (int)vr : (vr-FMI_INTEGER_SENSORVIEW_IN_EXTRA_OFFSET)%3; }
+    fmi2Integer fmi_sensor_view_in_size(int input) { return integer_vars[fmi_sensor_view_in_idx(input)+2]; }
+    const void* fmi_sensor_view_in_buffer(int input);
+    int fmi_sensor_data_out_idx(int output) { return output == 0 ? FMI_INTEGER_SENSORDATA_OUT_BASELO_IDX : FMI_INTEGER_SENSORDATA_OUT_EXTRA_OFFSET+3*(output-1); }
 
     /* Protocol Buffer Accessors */
-    bool get_fmi_sensor_view_in(osi3::SensorView& data);
-    void set_fmi_sensor_data_out(const osi3::SensorData& data);
-    void reset_fmi_sensor_data_out();
+    osi3::SensorView& reset_fmi_sensor_view_in(int input);
+    bool scan_fmi_sensor_view_in(int input, SensorViewTable& table);
+    bool check_fmi_sensor_view_in_unchanged();
+    bool get_fmi_sensor_view_in(int input, osi3::SensorView& data);
+    template<class Profile> void decode_fmi_sensor_view_in(int input);
+    void start_fmi_sensor_view_ins_decode();
+    int finish_fmi_sensor_view_ins_decode();
+    int decode_fmi_sensor_view_ins();
+    void commit_fmi_sensor_view_in(fmi2ValueReference vr);
+    void start_fmi_sensor_view_ins_eager_decode();
+    bool set_fmi_sensor_data_out(int output, const osi3::SensorData& data, const uint8_t*& written, bool splice_sensor_view_in = false);
+    bool set_fmi_sensor_data_outs(bool splice_sensor_view_in = false);
+    void reset_fmi_sensor_data_outs();
+    template<class Profile> void detect_moving_objects(double time);
+    template<class Profile> void encode_detected_moving_object(SensorDetection& detection, double time, COSMPWireWriter& out);
+    static unsigned int default_worker_count();
 };
@@ -0,0 +1,136 @@
+/*
+ * PMSF FMU Framework for FMI 2.0 Co-Simulation FMUs
+ *
+ * (C) 2016 -- 2018 PMSF IT Consulting Pierre R. Mai
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef OSMPSensorProfiles_h
+#define OSMPSensorProfiles_h
+
+/*
+ * Sensor Profiles
+ *
+ * The variants of the dummy sensor differ in their profile, a type
+ * that is only made of compile-time constants and policies, so that
+ * the detection core is specialized for each variant instead of
+ * branching on a configuration.  A profile provides:
+ *
+ * - range(), the detection range in meters, and min_cos(), the
+ *   cosine of half the horizontal opening angle
+ * - Probability::existence(distance), the existence probability of
+ *   a detection at the given distance
+ * - Noise::apply(id, time, x, y, z), which adds measurement noise to
+ *   a detected position; it only depends on its arguments, so that
+ *   outputs stay reproducible
+ *
+ * Every profile is built as an FMU of its own, see SENSOR_PROFILES in
+ * CMakeLists.txt.
+ */
+
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+
+/* Probability Policies */
+
+/* Cosine falling off from the middle of the range */
+template<class Profile>
+struct COSMPCosineExistence {
+    static double existence(double distance)
+    {
+        return cos((distance-Profile::range()/2)/(Profile::range()/2));
+    }
+};
+
+/* Falling off linearly over the range */
+template<class Profile>
+struct COSMPLinearExistence {
+    static double existence(double distance)
+    {
+        double probability = 1.0 - distance/Profile::range();
+        return probability > 0.0 ? probability : 0.0;
+    }
+};
+
+/* Noise Policies */
+
+struct COSMPNoNoise {
+    static void apply(uint64_t, double, double&, double&, double&) {}
+};
+
+/* Gaussian noise of Profile::noise_sigma() meters on every axis, drawn from the id and time */
+template<class Profile>
+struct COSMPGaussianNoise {
+    static void apply(uint64_t id, double time, double& x, double& y, double& z)
+    {
+        uint64_t bits;
+        memcpy(&bits,&time,sizeof(bits));
+        uint64_t seed = mix(id ^ mix(bits));
+        x += Profile::noise_sigma()*normal(seed,0);
+        y += Profile::noise_sigma()*normal(seed,1);
+        z += Profile::noise_sigma()*normal(seed,2);
+    }
+
+private:
+    /* Finalizer of SplitMix64 */
+    static uint64_t mix(uint64_t v)
+    {
+        v ^= v >> 30;
+        v *= 0xBF58476D1CE4E5B9ULL;
+        v ^= v >> 27;
+        v *= 0x94D049BB133111EBULL;
+        v ^= v >> 31;
+        return v;
+    }
+
+    /* Standard normal sample by Box-Muller, from two uniform samples in (0,1] and [0,1) */
+    static double normal(uint64_t seed, uint64_t axis)
+    {
+        double u1 = ((mix(seed + 2*axis + 1) >> 11) + 1) * (1.0/9007199254740992.0);
+        double u2 = (mix(seed + 2*axis + 2) >> 11) * (1.0/9007199254740992.0);
+        return sqrt(-2.0*log(u1)) * cos(6.283185307179586*u2);
+    }
+};
+
+/* Profiles */
+
+/* The original dummy sensor: 150 m, 60 degree opening angle, no noise */
+struct COSMPDummySensorProfile {
+    static constexpr double range() { return 150.0; }
+    static constexpr double min_cos() { return 0.866025; }
+    typedef COSMPCosineExistence<COSMPDummySensorProfile> Probability;
+    typedef COSMPNoNoise Noise;
+};
+
+/* Long range radar: 250 m, 18 degree opening angle */
+struct COSMPLongRangeRadarProfile {
+    static constexpr double range() { return 250.0; }
+    static constexpr double min_cos() { return 0.987688; }
+    static constexpr double noise_sigma() { return 0.5; }
+    typedef COSMPLinearExistence<COSMPLongRangeRadarProfile> Probability;
+    typedef COSMPGaussianNoise<COSMPLongRangeRadarProfile> Noise;
+};
+
+/* Short range corner radar: 80 m, 150 degree opening angle */
+struct COSMPCornerRadarProfile {
+    static constexpr double range() { return 80.0; }
+    static constexpr double min_cos() { return 0.258819; }
+    static constexpr double noise_sigma() { return 0.2; }
+    typedef COSMPCosineExistence<COSMPCornerRadarProfile> Probability;
+    typedef COSMPGaussianNoise<COSMPCornerRadarProfile> Noise;
+};
+
+/* Camera: 120 m, 50 degree opening angle */
+struct COSMPCameraProfile {
+    static constexpr double range() { return 120.0; }
+    static constexpr double min_cos() { return 0.906308; }
+    static constexpr double noise_sigma() { return 0.1; }
+    typedef COSMPLinearExistence<COSMPCameraProfile> Probability;
+    typedef COSMPGaussianNoise<COSMPCameraProfile> Noise;
+};
+
+#endif
@@ -47,6 +47,9 @@
 #include <string>
 #include <algorithm>
 #include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <cctype>
 #include <cmath>
 
 using namespace std;
@@ -100,13 +103,17 @@ void encode_pointer_to_integer(const void* ptr,fmi2Integer& hi,fmi2Integer& lo)
 #endif
 }
 
-void COSMPDummySource::set_fmi_sensor_view_out(const osi3::SensorView& data)
+void COSMPDummySource::set_fmi_sensor_view_out(const void* data, size_t size)
 {
-    data.SerializeToString(&currentBuffer);
-    encode_pointer_to_integer(currentBuffer.data(),integer_vars[FMI_INTEGER_SENSORVIEW_OUT_BASEHI_IDX],integer_vars[FMI_INTEGER_SENSORVIEW_OUT_BASELO_IDX]);
-    integer_vars[FMI_INTEGER_SENSORVIEW_OUT_SIZE_IDX]=(fmi2Integer)currentBuffer.length();
-    normal_log("OSMP","Providing %08X %08X, writing from %p ...",integer_vars[FMI_INTEGER_SENSORVIEW_OUT_BASEHI_IDX],integer_vars[FMI_INTEGER_SENSORVIEW_OUT_BASELO_IDX],currentBuffer.data());
-    swap(currentBuffer,lastBuffer);
+    encode_pointer_to_integer(data,integer_vars[FMI_INTEGER_SENSORVIEW_OUT_BASEHI_IDX],integer_vars[FMI_INTEGER_SENSORVIEW_OUT_BASELO_IDX]);
+    integer_vars[FMI_INTEGER_SENSORVIEW_OUT_SIZE_IDX]=(fmi2Integer)size;
+    normal_log("OSMP","Providing %08X %08X, writing from %p ...",integer_vars[FMI_INTEGER_SENSORVIEW_OUT_BASEHI_IDX],integer_vars[FMI_INTEGER_SENSORVIEW_OUT_BASELO_IDX],data);
+    outputBufferIndex = (outputBufferIndex + 1) % OUTPUT_BUFFER_DEPTH;
+    if (traceRecorder.is_open()) {
+        if (!traceRecorder.record(data,size))
+            normal_log("OSMP","Trace recording fell behind, dropped output");
+        set_fmi_record_dropped((fmi2Integer)traceRecorder.dropped_frames());
+    }
 }
 
 void COSMPDummySource::reset_fmi_sensor_view_out()
@@ -120,6 +127,233 @@ void COSMPDummySource::reset_fmi_sensor_view_out()
  * Actual Core Content
  */
 
+/* The classic hand-placed vehicles */
+#define CLASSIC_VEHICLES 10
+static const double classic_y_offsets[CLASSIC_VEHICLES] = { 3.0, 3.0, 3.0, 0.25, 0, -0.25, -3.0, -3.0, -3.0, -3.0 };
+static const double classic_x_offsets[CLASSIC_VEHICLES] = { 0.0, 40.0, 100.0, 100.0, 0.0, 150.0, 5.0, 45.0, 85.0, 125.0 };
+static const double classic_x_speeds[CLASSIC_VEHICLES] = { 29.0, 30.0, 31.0, 25.0, 26.0, 28.0, 20.0, 22.0, 22.5, 23.0 };
+static const osi3::MovingObject_VehicleClassification_Type classic_veh_types[CLASSIC_VEHICLES] = {
+    osi3::MovingObject_VehicleClassification_Type_TYPE_MEDIUM_CAR,
+    osi3::MovingObject_VehicleClassification_Type_TYPE_SMALL_CAR,
+    osi3::MovingObject_VehicleClassification_Type_TYPE_COMPACT_CAR,
+    osi3::MovingObject_VehicleClassification_Type_TYPE_DELIVERY_VAN,
+    osi3::MovingObject_VehicleClassification_Type_TYPE_LUXURY_CAR,
+    osi3::MovingObject_VehicleClassification_Type_TYPE_MEDIUM_CAR,
+    osi3::MovingObject_VehicleClassification_Type_TYPE_COMPACT_CAR,
+    osi3::MovingObject_VehicleClassification_Type_TYPE_SMALL_CAR,
+    osi3::MovingObject_VehicleClassification_Type_TYPE_MOTORBIKE,
+    osi3::MovingObject_VehicleClassification_Type_TYPE_BUS };
+
+/* Lane width and road length per vehicle and lane of the generated traffic, in meters */
+#define TRAFFIC_LANE_WIDTH 3.0
+#define TRAFFIC_VEHICLE_SPACING 40.0
+
+/* Next number of the SplitMix64 sequence */
+static uint64_t splitmix64(uint64_t& state)
+{
+    uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+/* Uniform number in [0,1) */
+static double uniform(uint64_t& state)
+{
+    return (splitmix64(state) >> 11) * (1.0/9007199254740992.0);
+}
+
+/* Local path of a file URI, as given for the resource location */
+static string file_uri_to_path(const string& uri)
+{
+    string path;
+    if (uri.compare(0,17,"file://localhost/") == 0)
+        path = uri.substr(16);
+    else if (uri.compare(0,8,"file:///") == 0)
+        path = uri.substr(7);
+    else if (uri.compare(0,5,"file:") == 0)
+        path = uri.substr(5);
+    else
+        return uri;
+    /* Percent-encoded characters */
+    string decoded;
+    for (size_t i = 0; i < path.size(); i++) {
+        if (path[i] == '%' && i + 2 < path.size() && isxdigit((unsigned char)path[i+1]) && isxdigit((unsigned char)path[i+2])) {
+            decoded += (char)strtol(path.substr(i+1,2).c_str(),NULL,16);
+            i += 2;
+        } else {
+            decoded += path[i];
+        }
+    }
+#ifdef _WIN32
+    /* Drive letters come as /C:/... */
+    if (decoded.size() > 2 && decoded[0] == '/' && decoded[2] == ':')
+        decoded.erase(0,1);
+#endif
+    return decoded;
+}
+
+static bool is_absolute_path(const string& path)
+{
+#ifdef _WIN32
+    if (path.size() > 1 && path[1] == ':')
+        return true;
+    if (!path.empty() && path[0] == '\\')
+        return true;
+#endif
+    return !path.empty() && path[0] == '/';
+}
+
+/*
+ * Opens the trace given by the replayTrace parameter, either a path or
+ * a file URI.  Relative paths are taken relative to the resources of
+ * the FMU, so that traces can be shipped inside it.
+ */
+bool COSMPDummySource::open_replay_trace()
+{
+    string path = file_uri_to_path(fmi_replay_trace());
+    if (!is_absolute_path(path) && !fmuResourceLocation.empty()) {
+        string resources = file_uri_to_path(fmuResourceLocation);
+        if (!resources.empty() && resources[resources.size()-1] != '/')
+            resources += '/';
+        path = resources + path;
+    }
+    if (!replayTrace.open(path,osi3::SensorView::kTimestampFieldNumber)) {
+        normal_log("OSMP","Cannot replay trace %s, it cannot be read or holds no frame",path.c_str());
+        return false;
+    }
+    replayNextFrame = 0;
+    normal_log("OSMP","Replaying %u frames of trace %s",(unsigned int)replayTrace.frame_count(),path.c_str());
+    return true;
+}
+
+void COSMPDummySource::provide_replay_frame(size_t frame)
+{
+    normal_log("OSI","Replaying frame %u at %f",(unsigned int)frame,replayTrace.frame_time(frame));
+    set_fmi_sensor_view_out(replayTrace.frame_data(frame),replayTrace.frame_size(frame));
+    set_fmi_valid(true);
+    /* Frames are not looked into, so their objects are not counted */
+    set_fmi_count(0);
+}
+
+void COSMPDummySource::generate_traffic()
+{
+    size_t count = fmi_object_count() > 0 ? (size_t)fmi_object_count() : 0;
+    unsigned int lanes = fmi_lane_count() > 0 ? (unsigned int)fmi_lane_count() : 1;
+    uint64_t state = (uint64_t)(int64_t)fmi_seed();
+    double spread = TRAFFIC_VEHICLE_SPACING*ceil((double)count/lanes);
+    traffic.resize(count);
+    for (size_t i = 0; i < count; i++) {
+        if (i < CLASSIC_VEHICLES) {
+            traffic.x_offset[i] = classic_x_offsets[i];
+            traffic.y_offset[i] = classic_y_offsets[i];
+            traffic.speed[i] = classic_x_speeds[i];
+            traffic.vehicle_type[i] = classic_veh_types[i];
+        } else {
+            unsigned int lane = (unsigned int)(splitmix64(state) % lanes);
+            traffic.x_offset[i] = (uniform(state) - 0.5)*spread;
+            traffic.y_offset[i] = ((lanes - 1)/2.0 - lane)*TRAFFIC_LANE_WIDTH;
+            traffic.speed[i] = 20.0 + 12.0*uniform(state);
+            traffic.vehicle_type[i] = classic_veh_types[splitmix64(state) % CLASSIC_VEHICLES];
+        }
+    }
+    normal_log("OSI","Generated %u vehicles on %u lanes from seed %d",(unsigned int)count,lanes,fmi_seed());
+    encode_ground_truth_template();
+}
+
+/* Returns the offset of the value of x, those of y and z follow 9 bytes apart each */
+static size_t write_vector3d(COSMPWireWriter& out, uint32_t field, double x, double y, double z)
+{
+    size_t mark = out.begin_message(field);
+    out.write_double(osi3::Vector3d::kXFieldNumber,x);
+    size_t offset = out.size() - 8;
+    out.write_double(osi3::Vector3d::kYFieldNumber,y);
+    out.write_double(osi3::Vector3d::kZFieldNumber,z);
+    out.end_message(mark);
+    return offset;
+}
+
+static void write_orientation3d(COSMPWireWriter& out, uint32_t field, double roll, double pitch, double yaw)
+{
+    size_t mark = out.begin_message(field);
+    out.write_double(osi3::Orientation3d::kRollFieldNumber,roll);
+    out.write_double(osi3::Orientation3d::kPitchFieldNumber,pitch);
+    out.write_double(osi3::Orientation3d::kYawFieldNumber,yaw);
+    out.end_message(mark);
+}
+
+/*
+ * Encodes the fields of the global ground truth following its
+ * timestamp, with all fields in the order of their numbers, as the
+ * message tree would serialize it, and notes where the kinematics of
+ * every vehicle are.
+ */
+void COSMPDummySource::encode_ground_truth_template()
+{
+    typedef osi3::MovingObject::VehicleClassification Classification;
+    typedef osi3::MovingObject::VehicleClassification::LightState LightState;
+    COSMPWireWriter& out = groundTruthTemplate;
+    out.clear();
+    groundTruthOffsets.resize(traffic.size());
+    size_t id = out.begin_message(osi3::GroundTruth::kHostVehicleIdFieldNumber);
+    out.write_varint(osi3::Identifier::kValueFieldNumber,14);
+    out.end_message(id);
+
+    for (size_t i = 0; i < traffic.size(); i++) {
+        size_t veh = out.begin_message(osi3::GroundTruth::kMovingObjectFieldNumber);
+        id = out.begin_message(osi3::MovingObject::kIdFieldNumber);
+        out.write_varint(osi3::Identifier::kValueFieldNumber,10+i);
+        out.end_message(id);
+        size_t base = out.begin_message(osi3::MovingObject::kBaseFieldNumber);
+        size_t dimension = out.begin_message(osi3::BaseMoving::kDimensionFieldNumber);
+        out.write_double(osi3::Dimension3d::kLengthFieldNumber,5.0);
+        out.write_double(osi3::Dimension3d::kWidthFieldNumber,2.0);
+        out.write_double(osi3::Dimension3d::kHeightFieldNumber,1.5);
+        out.end_message(dimension);
+        size_t position = write_vector3d(out,osi3::BaseMoving::kPositionFieldNumber,traffic.x[i],traffic.y[i],0.0);
+        write_orientation3d(out,osi3::BaseMoving::kOrientationFieldNumber,0.0,0.0,0.0);
+        size_t velocity = write_vector3d(out,osi3::BaseMoving::kVelocityFieldNumber,traffic.speed[i],traffic.velocity_y[i],0.0);
+        size_t acceleration = write_vector3d(out,osi3::BaseMoving::kAccelerationFieldNumber,0.0,traffic.acceleration_y[i],0.0);
+        write_orientation3d(out,osi3::BaseMoving::kOrientationRateFieldNumber,0.0,0.0,0.0);
+        /* Ending the enclosing messages moves their content by the bytes their lengths need beyond the room left */
+        size_t unmoved = out.size();
+        out.end_message(base);
+        size_t moved = out.size() - unmoved;
+        out.write_varint(osi3::MovingObject::kTypeFieldNumber,osi3::MovingObject_Type_TYPE_VEHICLE);
+        size_t classification = out.begin_message(osi3::MovingObject::kVehicleClassificationFieldNumber);
+        out.write_varint(Classification::kTypeFieldNumber,(uint64_t)(int64_t)traffic.vehicle_type[i]);
+        size_t lights = out.begin_message(Classification::kLightStateFieldNumber);
+        out.write_varint(LightState::kIndicatorStateFieldNumber,osi3::MovingObject_VehicleClassification_LightState_IndicatorState_INDICATOR_STATE_OFF);
+        out.write_varint(LightState::kBrakeLightStateFieldNumber,osi3::MovingObject_VehicleClassification_LightState_BrakeLightState_BRAKE_LIGHT_STATE_OFF);
+        out.end_message(lights);
+        out.end_message(classification);
+        unmoved = out.size();
+        out.end_message(veh);
+        moved += out.size() - unmoved;
+        SourceTemplateOffsets& offsets = groundTruthOffsets[i];
+        offsets.x = position + moved;
+        offsets.y = position + 9 + moved;
+        offsets.velocity_y = velocity + 9 + moved;
+        offsets.acceleration_y = acceleration + 9 + moved;
+    }
+}
+
+/* Patches the kinematics of the current step into the template and writes the global ground truth */
+void COSMPDummySource::write_ground_truth(COSMPWireWriter& out, double time)
+{
+    for (size_t i = 0; i < traffic.size(); i++) {
+        const SourceTemplateOffsets& offsets = groundTruthOffsets[i];
+        groundTruthTemplate.patch_double(offsets.x,traffic.x[i]);
+        groundTruthTemplate.patch_double(offsets.y,traffic.y[i]);
+        groundTruthTemplate.patch_double(offsets.velocity_y,traffic.velocity_y[i]);
+        groundTruthTemplate.patch_double(offsets.acceleration_y,traffic.acceleration_y[i]);
+    }
+    size_t gt = out.begin_message(osi3::SensorView::kGlobalGroundTruthFieldNumber,lastGroundTruthSize);
+    osmp_write_timestamp(out,osi3::GroundTruth::kTimestampFieldNumber,time);
+    out.append(groundTruthTemplate.data(),groundTruthTemplate.size());
+    lastGroundTruthSize = out.end_message(gt);
+}
+
 fmi2Status COSMPDummySource::doInit()
 {
     DEBUGBREAK();
@@ -140,6 +374,10 @@ fmi2Status COSMPDummySource::doInit()
     for (int i = 0; i<FMI_STRING_VARS; i++)
         string_vars[i] = "";
 
+    /* Parameters */
+    integer_vars[FMI_INTEGER_OBJECT_COUNT_IDX] = CLASSIC_VEHICLES;
+    integer_vars[FMI_INTEGER_LANE_COUNT_IDX] = 3;
+
     return fmi2OK;
 }
 
@@ -157,103 +395,94 @@ fmi2Status COSMPDummySource::doEnterInitializationMode()
 
 fmi2Status COSMPDummySource::doExitInitializationMode()
 {
+    replayTrace.close();
+    traceRecorder.close();
+    if (!fmi_record_trace().empty()) {
+        if (!traceRecorder.open(fmi_record_trace(),TRACE_RECORDER_BUFFER)) {
+            normal_log("OSMP","Cannot record trace to %s",fmi_record_trace().c_str());
+            return fmi2Error;
+        }
+        normal_log("OSMP","Recording outputs to %s",fmi_record_trace().c_str());
+    }
+    if (!fmi_replay_trace().empty()) {
+        if (!open_replay_trace())
+            return fmi2Error;
+        traffic.resize(0);
+        /*
+         * Resumed scenarios start with the frame at their start time;
+         * traces without timestamps start with the first frame, which the
+         * first step then moves on from.
+         */
+        if (replayTrace.has_timestamps()) {
+            provide_replay_frame(replayTrace.find(last_time));
+        } else {
+            provide_replay_frame(0);
+            replayNextFrame = 1;
+        }
+        return fmi2OK;
+    }
+    generate_traffic();
     return fmi2OK;
 }
 
-void rotatePoint(double x, double y, double z,double yaw,double pitch,double roll,double &rx,double &ry,double &rz)
-{
-    double matrix[3][3];
-    double cos_yaw = cos(yaw);
-    double cos_pitch = cos(pitch);
-    double cos_roll = cos(roll);
-    double sin_yaw = sin(yaw);
-    double sin_pitch = sin(pitch);
-    double sin_roll = sin(roll);
-
-    matrix[0][0] = cos_yaw*cos_pitch;  matrix[0][1]=cos_yaw*sin_pitch*sin_roll - sin_yaw*cos_roll; matrix[0][2]=cos_yaw*sin_pitch*cos_roll + sin_yaw*sin_roll;
-    matrix[1][0] = sin_yaw*cos_pitch;  matrix[1][1]=sin_yaw*sin_pitch*sin_roll + cos_yaw*cos_roll; matrix[1][2]=sin_yaw*sin_pitch*cos_roll - cos_yaw*sin_roll;
-    matrix[2][0] = -sin_pitch;         matrix[2][1]=cos_pitch*sin_roll;                            matrix[2][2]=cos_pitch*cos_roll;
-
-    rx = matrix[0][0] * x + matrix[0][1] * y + matrix[0][2] * z;
-    ry = matrix[1][0] * x + matrix[1][1] * y + matrix[1][2] * z;
-    rz = matrix[2][0] * x + matrix[2][1] * y + matrix[2][2] * z;
-}
-
 fmi2Status COSMPDummySource::doCalc(fmi2Real currentCommunicationPoint, fmi2Real communicationStepSize, fmi2Boolean noSetFMUStatePriorToCurrentPointfmi2Component)
 {
     DEBUGBREAK();
-    osi3::SensorView currentOut;
     double time = currentCommunicationPoint+communicationStepSize;
 
     normal_log("OSI","Calculating SensorView at %f for %f (step size %f)",currentCommunicationPoint,time,communicationStepSize);
 
+    if (replayTrace.is_open()) {
+        /*
+         * Frames are provided in place, the last one at or before the end
+         * of the step, so that any communication point can be served, or
+         * one per step for traces without timestamps; the last frame is
+         * kept once the trace is exhausted.
+         */
+        size_t frame;
+        if (replayTrace.has_timestamps())
+            frame = replayTrace.find(time);
+        else
+            frame = replayNextFrame < replayTrace.frame_count() ? replayNextFrame++ : replayTrace.frame_count()-1;
+        provide_replay_frame(frame);
+        return fmi2OK;
+    }
+
     /* We act as GroundTruth Source */
-    static double source_y_offsets[10] = { 3.0, 3.0, 3.0, 0.25, 0, -0.25, -3.0, -3.0, -3.0, -3.0 };
-    static double source_x_offsets[10] = { 0.0, 40.0, 100.0, 100.0, 0.0, 150.0, 5.0, 45.0, 85.0, 125.0 };
-    static double source_x_speeds[10] = { 29.0, 30.0, 31.0, 25.0, 26.0, 28.0, 20.0, 22.0, 22.5, 23.0 };
-    static osi3::MovingObject_VehicleClassification_Type source_veh_types[10] = {
-        osi3::MovingObject_VehicleClassification_Type_TYPE_MEDIUM_CAR,
-        osi3::MovingObject_VehicleClassification_Type_TYPE_SMALL_CAR,
-        osi3::MovingObject_VehicleClassification_Type_TYPE_COMPACT_CAR,
-        osi3::MovingObject_VehicleClassification_Type_TYPE_DELIVERY_VAN,
-        osi3::MovingObject_VehicleClassification_Type_TYPE_LUXURY_CAR,
-        osi3::MovingObject_VehicleClassification_Type_TYPE_MEDIUM_CAR,
-        osi3::MovingObject_VehicleClassification_Type_TYPE_COMPACT_CAR,
-        osi3::MovingObject_VehicleClassification_Type_TYPE_SMALL_CAR,
-        osi3::MovingObject_VehicleClassification_Type_TYPE_MOTORBIKE,
-        osi3::MovingObject_VehicleClassification_Type_TYPE_BUS };
-
-    currentOut.Clear();
-    currentOut.mutable_version()->CopyFrom(osi3::InterfaceVersion::descriptor()->file()->options().GetExtension(osi3::current_interface_version));
-    currentOut.mutable_sensor_id()->set_value(10000);
-    currentOut.mutable_host_vehicle_id()->set_value(14);
-    osi3::GroundTruth *currentGT = currentOut.mutable_global_ground_truth();
-    currentOut.mutable_timestamp()->set_seconds((long long int)floor(time));
-    currentOut.mutable_timestamp()->set_nanos((int)((time - floor(time))*1000000000.0));
-    currentGT->mutable_timestamp()->set_seconds((long long int)floor(time));
-    currentGT->mutable_timestamp()->set_nanos((int)((time - floor(time))*1000000000.0));
-    currentGT->mutable_host_vehicle_id()->set_value(14);
-
-    // Vehicles
-    for (unsigned int i=0;i<10;i++) {
-        osi3::MovingObject *veh = currentGT->add_moving_object();
-        veh->mutable_id()->set_value(10+i);
-        veh->set_type(osi3::MovingObject_Type_TYPE_VEHICLE);
-        auto vehclass = veh->mutable_vehicle_classification();
-        vehclass->set_type(source_veh_types[i]);
-        auto vehlights = vehclass->mutable_light_state();
-        vehlights->set_indicator_state(osi3::MovingObject_VehicleClassification_LightState_IndicatorState_INDICATOR_STATE_OFF);
-        vehlights->set_brake_light_state(osi3::MovingObject_VehicleClassification_LightState_BrakeLightState_BRAKE_LIGHT_STATE_OFF);
-        veh->mutable_base()->mutable_dimension()->set_height(1.5);
-        veh->mutable_base()->mutable_dimension()->set_width(2.0);
-        veh->mutable_base()->mutable_dimension()->set_length(5.0);
-        veh->mutable_base()->mutable_position()->set_x(source_x_offsets[i]+time*source_x_speeds[i]);
-        veh->mutable_base()->mutable_position()->set_y(source_y_offsets[i]+sin(time/source_x_speeds[i])*0.25);
-        veh->mutable_base()->mutable_position()->set_z(0.0);
-        veh->mutable_base()->mutable_velocity()->set_x(source_x_speeds[i]);
-        veh->mutable_base()->mutable_velocity()->set_y(cos(time/source_x_speeds[i])*0.25/source_x_speeds[i]);
-        veh->mutable_base()->mutable_velocity()->set_z(0.0);
-        veh->mutable_base()->mutable_acceleration()->set_x(0.0);
-        veh->mutable_base()->mutable_acceleration()->set_y(-sin(time/source_x_speeds[i])*0.25/(source_x_speeds[i]*source_x_speeds[i]));
-        veh->mutable_base()->mutable_acceleration()->set_z(0.0);
-        veh->mutable_base()->mutable_orientation()->set_pitch(0.0);
-        veh->mutable_base()->mutable_orientation()->set_roll(0.0);
-        veh->mutable_base()->mutable_orientation()->set_yaw(0.0);
-        veh->mutable_base()->mutable_orientation_rate()->set_pitch(0.0);
-        veh->mutable_base()->mutable_orientation_rate()->set_roll(0.0);
-        veh->mutable_base()->mutable_orientation_rate()->set_yaw(0.0);
-        normal_log("OSI","GT: Adding Vehicle %d[%d] Absolute Position: %f,%f,%f Velocity (%f,%f,%f)",i,veh->id().value(),veh->base().position().x(),veh->base().position().y(),veh->base().position().z(),veh->base().velocity().x(),veh->base().velocity().y(),veh->base().velocity().z());
-    }
-
-    set_fmi_sensor_view_out(currentOut);
+    size_t n = traffic.size();
+    for (size_t i = 0; i < n; i++)
+        traffic.angle[i] = time/traffic.speed[i];
+    osmp_sincos(n,traffic.angle.data(),traffic.sway_sin.data(),traffic.sway_cos.data());
+    for (size_t i = 0; i < n; i++) {
+        double speed = traffic.speed[i];
+        traffic.x[i] = traffic.x_offset[i]+time*speed;
+        traffic.y[i] = traffic.y_offset[i]+traffic.sway_sin[i]*0.25;
+        traffic.velocity_y[i] = traffic.sway_cos[i]*0.25/speed;
+        traffic.acceleration_y[i] = -traffic.sway_sin[i]*0.25/(speed*speed);
+    }
+    for (size_t i = 0; i < n; i++)
+        normal_log("OSI","GT: Adding Vehicle %d[%d] Absolute Position: %f,%f,%f Velocity (%f,%f,%f)",(int)i,(int)(10+i),traffic.x[i],traffic.y[i],0.0,traffic.speed[i],traffic.velocity_y[i],0.0);
+
+    /* Version, Timestamp and Ids, then the Ground Truth */
+    COSMPWireWriter& currentOut = outputBuffers[outputBufferIndex];
+    currentOut.clear();
+    sensorViewStaticHeader.write(currentOut,time);
+    write_ground_truth(currentOut,time);
+
+    set_fmi_sensor_view_out(currentOut.data(),currentOut.size());
     set_fmi_valid(true);
-    set_fmi_count(currentGT->moving_object_size());
+    set_fmi_count((fmi2Integer)n);
     return fmi2OK;
 }
 
 fmi2Status COSMPDummySource::doTerm()
 {
     DEBUGBREAK();
+    replayTrace.close();
+    if (traceRecorder.is_open()) {
+        traceRecorder.close();
+        normal_log("OSMP","Recorded %llu outputs, dropped %llu outputs (%llu bytes)%s",(unsigned long long)traceRecorder.recorded_frames(),(unsigned long long)traceRecorder.dropped_frames(),(unsigned long long)traceRecorder.dropped_bytes(),traceRecorder.write_failed() ? ", writing failed" : "");
+    }
     return fmi2OK;
 }
 
@@ -274,8 +503,14 @@ COSMPDummySource::COSMPDummySource(fmi2String theinstanceName, fmi2Type thefmuTy
     functions(*thefunctions),
     visible(!!thevisible),
     loggingOn(!!theloggingOn),
-    last_time(0.0)
+    last_time(0.0),
+    outputBufferIndex(0),
+    sensorViewStaticHeader(osi3::SensorView::kVersionFieldNumber,osi3::SensorView::kTimestampFieldNumber),
+    lastGroundTruthSize(0),
+    replayNextFrame(0)
 {
+    sensorViewStaticHeader.add_identifier(osi3::SensorView::kSensorIdFieldNumber,10000);
+    sensorViewStaticHeader.add_identifier(osi3::SensorView::kHostVehicleIdFieldNumber,14);
     loggingCategories.clear();
     loggingCategories.insert("FMI");
     loggingCategories.insert("OSMP");
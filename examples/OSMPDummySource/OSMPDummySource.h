@@ -51,7 +51,11 @@ using namespace std;
 #define FMI_INTEGER_SENSORVIEW_OUT_BASEHI_IDX 1
 #define FMI_INTEGER_SENSORVIEW_OUT_SIZE_IDX 2
 #define FMI_INTEGER_COUNT_IDX 3
-#define FMI_INTEGER_LAST_IDX FMI_INTEGER_COUNT_IDX
+#define FMI_INTEGER_OBJECT_COUNT_IDX 4
+#define FMI_INTEGER_LANE_COUNT_IDX 5
+#define FMI_INTEGER_SEED_IDX 6
+#define FMI_INTEGER_RECORD_DROPPED_IDX 7
+#define FMI_INTEGER_LAST_IDX FMI_INTEGER_RECORD_DROPPED_IDX
 #define FMI_INTEGER_VARS (FMI_INTEGER_LAST_IDX+1)
 
 /* Real Variables */
@@ -59,18 +63,99 @@ using namespace std;
 #define FMI_REAL_VARS (FMI_REAL_LAST_IDX+1)
 
 /* String Variables */
-#define FMI_STRING_LAST_IDX 0
+#define FMI_STRING_REPLAY_TRACE_IDX 0
+#define FMI_STRING_RECORD_TRACE_IDX 1
+#define FMI_STRING_LAST_IDX FMI_STRING_RECORD_TRACE_IDX
 #define FMI_STRING_VARS (FMI_STRING_LAST_IDX+1)
 
+/*
+ * Output Buffering
+ *
+ * OUTPUT_BUFFER_DEPTH gives the number of output buffers that are
+ * cycled through, i.e. a buffer provided at the end of one fmi2DoStep
+ * call stays valid until the beginning of the OUTPUT_BUFFER_DEPTH-th
+ * fmi2DoStep call after that.  The OSMP specification requires at
+ * least 2 (double buffering); deeper rings are advertised through the
+ * buffer-depth attribute of the binary variable annotations.
+ */
+#ifndef OUTPUT_BUFFER_DEPTH
+#define OUTPUT_BUFFER_DEPTH 2
+#endif
+#if OUTPUT_BUFFER_DEPTH < 2
+#error "OUTPUT_BUFFER_DEPTH must be at least 2"
+#endif
+
 #include <iostream>
 #include <fstream>
 #include <string>
 #include <cstdarg>
 #include <set>
+#include <vector>
 
 #undef min
 #undef max
 #include "osi_sensorview.pb.h"
+#include "OSMPStaticHeader.h"
+#include "OSMPGeometry.h"
+#include "OSMPTraceFile.h"
+
+/*
+ * Trace Recording
+ *
+ * If the recordTrace parameter names a file, every SensorView output
+ * provided, generated or replayed, is recorded to it as OSI trace.  The
+ * outputs are queued and written in the background, see
+ * OSMPTraceRecorder.h; TRACE_RECORDER_BUFFER gives the bytes queued at
+ * most, outputs that do not fit are dropped and counted in
+ * record.dropped.
+ */
+#include "OSMPTraceRecorder.h"
+#ifndef TRACE_RECORDER_BUFFER
+#define TRACE_RECORDER_BUFFER 67108864
+#endif
+
+/*
+ * Generated Traffic
+ *
+ * The source generates objectCount vehicles on laneCount lanes of a
+ * straight road, all driving along x and swaying slightly across their
+ * lane.  The first ten vehicles are the classic hand-placed ones, any
+ * further vehicles are spread over the lanes by a random sequence drawn
+ * from seed, so that the same parameters give the same traffic.  The
+ * state is kept as structure of arrays, so that the kinematics of all
+ * vehicles are calculated in tight loops over contiguous arrays.
+ */
+struct SourceTraffic {
+    /* Fixed per vehicle */
+    std::vector<double> x_offset, y_offset, speed;
+    std::vector<int> vehicle_type;
+    /* Calculated per step */
+    std::vector<double> angle, sway_sin, sway_cos;
+    std::vector<double> x, y, velocity_y, acceleration_y;
+
+    size_t size() const { return speed.size(); }
+    void resize(size_t n)
+    {
+        x_offset.resize(n); y_offset.resize(n); speed.resize(n); vehicle_type.resize(n);
+        angle.resize(n); sway_sin.resize(n); sway_cos.resize(n);
+        x.resize(n); y.resize(n); velocity_y.resize(n); acceleration_y.resize(n);
+    }
+};
+
+/*
+ * Ground Truth Template
+ *
+ * Everything but the kinematics of the generated vehicles stays the
+ * same from step to step, and all their fields are written even when
+ * zero, so the encoded layout of the ground truth does not change
+ * either.  It is therefore encoded only once, after the traffic is
+ * generated, and every step just patches the doubles of the dynamic
+ * fields in place, at the offsets noted per vehicle, and copies the
+ * template behind the timestamp of the step.
+ */
+struct SourceTemplateOffsets {
+    size_t x, y, velocity_y, acceleration_y;
+};
 
 /* FMU Class */
 class COSMPDummySource {
@@ -106,6 +191,12 @@ protected:
     fmi2Status doTerm();
     void doFree();
 
+    bool open_replay_trace();
+    void provide_replay_frame(size_t frame);
+    void generate_traffic();
+    void encode_ground_truth_template();
+    void write_ground_truth(COSMPWireWriter& out, double time);
+
 protected:
     /* Private File-based Logging just for Debugging */
 #ifdef PRIVATE_LOG_PATH
@@ -191,16 +282,35 @@ protected:
     fmi2Real real_vars[FMI_REAL_VARS];
     string string_vars[FMI_STRING_VARS];
     double last_time;
-    string currentBuffer;
-    string lastBuffer;
+    /* The output is encoded straight into these buffers, no message tree is built */
+    COSMPWireWriter outputBuffers[OUTPUT_BUFFER_DEPTH];
+    unsigned int outputBufferIndex;
+    /* Fields of the output encoded once per instance */
+    COSMPStaticHeader sensorViewStaticHeader;
+    SourceTraffic traffic;
+    /* Ground truth fields following the timestamp, and the offsets of the fields patched per vehicle */
+    COSMPWireWriter groundTruthTemplate;
+    std::vector<SourceTemplateOffsets> groundTruthOffsets;
+    /* Size of the last ground truth, to reserve room for its length */
+    size_t lastGroundTruthSize;
+    /* Trace replayed instead of the generated traffic, if any, and the next frame of traces without timestamps */
+    COSMPTraceFile replayTrace;
+    size_t replayNextFrame;
+    COSMPTraceRecorder traceRecorder;
 
     /* Simple Accessors */
     fmi2Boolean fmi_valid() { return boolean_vars[FMI_BOOLEAN_VALID_IDX]; }
     void set_fmi_valid(fmi2Boolean value) { boolean_vars[FMI_BOOLEAN_VALID_IDX]=value; }
     fmi2Integer fmi_count() { return integer_vars[FMI_INTEGER_COUNT_IDX]; }
     void set_fmi_count(fmi2Integer value) { integer_vars[FMI_INTEGER_COUNT_IDX]=value; }
+    fmi2Integer fmi_object_count() { return integer_vars[FMI_INTEGER_OBJECT_COUNT_IDX]; }
+    fmi2Integer fmi_lane_count() { return integer_vars[FMI_INTEGER_LANE_COUNT_IDX]; }
+    fmi2Integer fmi_seed() { return integer_vars[FMI_INTEGER_SEED_IDX]; }
+    string fmi_replay_trace() { return string_vars[FMI_STRING_REPLAY_TRACE_IDX]; }
+    void set_fmi_record_dropped(fmi2Integer value) { integer_vars[FMI_INTEGER_RECORD_DROPPED_IDX]=value; }
+    string fmi_record_trace() { return string_vars[FMI_STRING_RECORD_TRACE_IDX]; }
 
     /* Protocol Buffer Accessors */
-    void set_fmi_sensor_view_out(const osi3::SensorView& data);
+    void set_fmi_sensor_view_out(const void* data, size_t size);
     void reset_fmi_sensor_view_out();
 };
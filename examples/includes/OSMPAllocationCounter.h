@@ -0,0 +1,74 @@
+/*
+ * PMSF FMU Framework for FMI 2.0 Co-Simulation FMUs
+ *
+ * (C) 2016 -- 2018 PMSF IT Consulting Pierre R. Mai
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef OSMPAllocationCounter_h
+#define OSMPAllocationCounter_h
+
+/*
+ * Allocation Counter
+ *
+ * Standard allocator for the containers of the detection core, which
+ * counts the allocations made and the bytes held through it, per
+ * thread, so that a step can report how often it touched the heap.
+ * Work done by one task on one thread is measured by the difference
+ * of osmp_allocation_count() before and after it.
+ */
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <vector>
+
+struct OSMPAllocationCount {
+    uint64_t allocations;
+    /* Bytes allocated minus bytes freed */
+    int64_t bytes;
+};
+
+/* Counts of the calling thread */
+inline OSMPAllocationCount& osmp_allocation_count()
+{
+    static thread_local OSMPAllocationCount count = { 0, 0 };
+    return count;
+}
+
+template<class T>
+class COSMPCountingAllocator {
+public:
+    typedef T value_type;
+
+    COSMPCountingAllocator() {}
+    template<class U> COSMPCountingAllocator(const COSMPCountingAllocator<U>&) {}
+
+    T* allocate(size_t n)
+    {
+        OSMPAllocationCount& count = osmp_allocation_count();
+        count.allocations++;
+        count.bytes += (int64_t)(n*sizeof(T));
+        return static_cast<T*>(::operator new(n*sizeof(T)));
+    }
+
+    void deallocate(T* p, size_t n)
+    {
+        osmp_allocation_count().bytes -= (int64_t)(n*sizeof(T));
+        ::operator delete(p);
+    }
+};
+
+template<class T, class U>
+inline bool operator==(const COSMPCountingAllocator<T>&, const COSMPCountingAllocator<U>&) { return true; }
+template<class T, class U>
+inline bool operator!=(const COSMPCountingAllocator<T>&, const COSMPCountingAllocator<U>&) { return false; }
+
+/* Vector whose storage is counted */
+template<class T>
+using COSMPCountedVector = std::vector<T, COSMPCountingAllocator<T> >;
+
+#endif
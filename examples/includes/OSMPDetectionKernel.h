@@ -0,0 +1,240 @@
+/*
+ * PMSF FMU Framework for FMI 2.0 Co-Simulation FMUs
+ *
+ * (C) 2016 -- 2018 PMSF IT Consulting Pierre R. Mai
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef OSMPDetectionKernel_h
+#define OSMPDetectionKernel_h
+
+/*
+ * Detection Kernel
+ *
+ * Object poses kept as a structure of arrays, so that the relative
+ * positions, distances and field of view tests of all objects can be
+ * calculated a few objects at a time with SIMD instructions.  AVX2 is
+ * used if the compiler targets it (e.g. -mavx2), SSE2 on any other
+ * x86-64 target, and plain scalar code everywhere else.  All variants
+ * perform the same operations in the same order, so their results
+ * agree exactly with each other.
+ *
+ * The orientation of every object is turned into a rotation matrix
+ * once per frame by osmp_orient_objects, using the batched sincos and
+ * the rotation cache of OSMPGeometry.h, so the kernels themselves need
+ * no trigonometry.
+ */
+
+#include <cstddef>
+#include <cstdint>
+#include <cmath>
+#include <vector>
+#include "OSMPAllocationCounter.h"
+#include "OSMPGeometry.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define OSMP_DETECTION_KERNEL_AVX2
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define OSMP_DETECTION_KERNEL_SSE2
+#endif
+
+/* Columns are padded to multiples of this many objects and aligned for it */
+#define OSMP_DETECTION_KERNEL_WIDTH 4
+
+class COSMPObjectColumns {
+public:
+    enum Column {
+        X, Y, Z,
+        YAW, PITCH, ROLL,
+        /* Rotation matrix, row by row */
+        M00, M01, M02, M10, M11, M12, M20, M21, M22,
+        /* Kernel results */
+        REL_X, REL_Y, REL_Z, DISTANCE,
+        COLUMNS
+    };
+
+    COSMPObjectColumns() : count(0), capacity(0), base(NULL) {}
+
+    size_t size() const { return count; }
+    double* column(Column c) { return base + c*capacity; }
+    const double* column(Column c) const { return base + c*capacity; }
+    /* Indices selected by the last call of osmp_cull_cone, room for all objects */
+    uint32_t* selected() { return selection.empty() ? NULL : &selection[0]; }
+    const uint32_t* selected() const { return selection.empty() ? NULL : &selection[0]; }
+    const uint64_t* ids() const { return objectIds.empty() ? NULL : &objectIds[0]; }
+
+    /*
+     * Sets the number of objects; storage only ever grows, so that
+     * the table does not touch the heap once it has reached its size.
+     * All poses have to be set again afterwards, only the padding is
+     * guaranteed to be zero.
+     */
+    void resize(size_t objects)
+    {
+        size_t padded = (objects + OSMP_DETECTION_KERNEL_WIDTH - 1) & ~(size_t)(OSMP_DETECTION_KERNEL_WIDTH - 1);
+        if (padded > capacity) {
+            size_t grown = capacity * 2 > padded ? capacity * 2 : padded;
+            storage.assign(grown * COLUMNS + OSMP_DETECTION_KERNEL_WIDTH, 0.0);
+            uintptr_t address = reinterpret_cast<uintptr_t>(&storage[0]);
+            uintptr_t alignment = OSMP_DETECTION_KERNEL_WIDTH * sizeof(double);
+            base = reinterpret_cast<double*>((address + alignment - 1) & ~(alignment - 1));
+            capacity = grown;
+            selection.resize(grown);
+            objectIds.resize(grown);
+        } else {
+            for (int c = 0; c < COLUMNS; c++)
+                for (size_t k = objects; k < padded; k++)
+                    column((Column)c)[k] = 0.0;
+        }
+        count = objects;
+    }
+
+    /* Stores the id, position and orientation (as in osi3::Orientation3d) of an object */
+    void set_pose(size_t k, uint64_t id, double x, double y, double z, double yaw, double pitch, double roll)
+    {
+        objectIds[k] = id;
+        column(X)[k] = x;
+        column(Y)[k] = y;
+        column(Z)[k] = z;
+        column(YAW)[k] = yaw;
+        column(PITCH)[k] = pitch;
+        column(ROLL)[k] = roll;
+    }
+
+private:
+    COSMPObjectColumns(const COSMPObjectColumns&);
+    COSMPObjectColumns& operator=(const COSMPObjectColumns&);
+
+    size_t count;
+    size_t capacity;
+    double* base;
+    COSMPCountedVector<double> storage;
+    COSMPCountedVector<uint32_t> selection;
+    COSMPCountedVector<uint64_t> objectIds;
+};
+
+/*
+ * Calculates the rotation matrices of all objects from their
+ * orientations, reusing those of the previous frame from the cache.
+ */
+inline void osmp_orient_objects(COSMPObjectColumns& objects, COSMPRotationCache& cache)
+{
+    typedef COSMPObjectColumns C;
+    double* const m[9] = {
+        objects.column(C::M00), objects.column(C::M01), objects.column(C::M02),
+        objects.column(C::M10), objects.column(C::M11), objects.column(C::M12),
+        objects.column(C::M20), objects.column(C::M21), objects.column(C::M22)
+    };
+    cache.rotate(objects.size(), objects.ids(), objects.column(C::YAW), objects.column(C::PITCH), objects.column(C::ROLL), m);
+}
+
+/*
+ * Calculates the position of every object relative to the origin,
+ * rotated by the orientation of the object, and its distance.
+ */
+inline void osmp_transform_objects(COSMPObjectColumns& objects, double origin_x, double origin_y, double origin_z)
+{
+    typedef COSMPObjectColumns C;
+    const double* x = objects.column(C::X);
+    const double* y = objects.column(C::Y);
+    const double* z = objects.column(C::Z);
+    const double* m00 = objects.column(C::M00); const double* m01 = objects.column(C::M01); const double* m02 = objects.column(C::M02);
+    const double* m10 = objects.column(C::M10); const double* m11 = objects.column(C::M11); const double* m12 = objects.column(C::M12);
+    const double* m20 = objects.column(C::M20); const double* m21 = objects.column(C::M21); const double* m22 = objects.column(C::M22);
+    double* rel_x = objects.column(C::REL_X);
+    double* rel_y = objects.column(C::REL_Y);
+    double* rel_z = objects.column(C::REL_Z);
+    double* distance = objects.column(C::DISTANCE);
+    size_t n = objects.size();
+#if defined(OSMP_DETECTION_KERNEL_AVX2)
+    __m256d ox = _mm256_set1_pd(origin_x), oy = _mm256_set1_pd(origin_y), oz = _mm256_set1_pd(origin_z);
+    for (size_t k = 0; k < n; k += 4) {
+        __m256d tx = _mm256_sub_pd(_mm256_load_pd(x+k), ox);
+        __m256d ty = _mm256_sub_pd(_mm256_load_pd(y+k), oy);
+        __m256d tz = _mm256_sub_pd(_mm256_load_pd(z+k), oz);
+        __m256d rx = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(_mm256_load_pd(m00+k), tx), _mm256_mul_pd(_mm256_load_pd(m01+k), ty)), _mm256_mul_pd(_mm256_load_pd(m02+k), tz));
+        __m256d ry = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(_mm256_load_pd(m10+k), tx), _mm256_mul_pd(_mm256_load_pd(m11+k), ty)), _mm256_mul_pd(_mm256_load_pd(m12+k), tz));
+        __m256d rz = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(_mm256_load_pd(m20+k), tx), _mm256_mul_pd(_mm256_load_pd(m21+k), ty)), _mm256_mul_pd(_mm256_load_pd(m22+k), tz));
+        _mm256_store_pd(rel_x+k, rx);
+        _mm256_store_pd(rel_y+k, ry);
+        _mm256_store_pd(rel_z+k, rz);
+        _mm256_store_pd(distance+k, _mm256_sqrt_pd(_mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(rx, rx), _mm256_mul_pd(ry, ry)), _mm256_mul_pd(rz, rz))));
+    }
+#elif defined(OSMP_DETECTION_KERNEL_SSE2)
+    __m128d ox = _mm_set1_pd(origin_x), oy = _mm_set1_pd(origin_y), oz = _mm_set1_pd(origin_z);
+    for (size_t k = 0; k < n; k += 2) {
+        __m128d tx = _mm_sub_pd(_mm_load_pd(x+k), ox);
+        __m128d ty = _mm_sub_pd(_mm_load_pd(y+k), oy);
+        __m128d tz = _mm_sub_pd(_mm_load_pd(z+k), oz);
+        __m128d rx = _mm_add_pd(_mm_add_pd(_mm_mul_pd(_mm_load_pd(m00+k), tx), _mm_mul_pd(_mm_load_pd(m01+k), ty)), _mm_mul_pd(_mm_load_pd(m02+k), tz));
+        __m128d ry = _mm_add_pd(_mm_add_pd(_mm_mul_pd(_mm_load_pd(m10+k), tx), _mm_mul_pd(_mm_load_pd(m11+k), ty)), _mm_mul_pd(_mm_load_pd(m12+k), tz));
+        __m128d rz = _mm_add_pd(_mm_add_pd(_mm_mul_pd(_mm_load_pd(m20+k), tx), _mm_mul_pd(_mm_load_pd(m21+k), ty)), _mm_mul_pd(_mm_load_pd(m22+k), tz));
+        _mm_store_pd(rel_x+k, rx);
+        _mm_store_pd(rel_y+k, ry);
+        _mm_store_pd(rel_z+k, rz);
+        _mm_store_pd(distance+k, _mm_sqrt_pd(_mm_add_pd(_mm_add_pd(_mm_mul_pd(rx, rx), _mm_mul_pd(ry, ry)), _mm_mul_pd(rz, rz))));
+    }
+#else
+    for (size_t k = 0; k < n; k++) {
+        double tx = x[k] - origin_x;
+        double ty = y[k] - origin_y;
+        double tz = z[k] - origin_z;
+        rel_x[k] = m00[k]*tx + m01[k]*ty + m02[k]*tz;
+        rel_y[k] = m10[k]*tx + m11[k]*ty + m12[k]*tz;
+        rel_z[k] = m20[k]*tx + m21[k]*ty + m22[k]*tz;
+        distance[k] = sqrt(rel_x[k]*rel_x[k] + rel_y[k]*rel_y[k] + rel_z[k]*rel_z[k]);
+    }
+#endif
+}
+
+/*
+ * Selects the objects within range whose relative position lies
+ * inside the cone around the direction (dir_cos, dir_sin) in the x/y
+ * plane, i.e. whose direction cosine exceeds min_cos.  Expects the
+ * results of osmp_transform_objects, returns the number of objects
+ * selected, whose indices are then available in ascending order from
+ * selected().
+ */
+inline size_t osmp_cull_cone(COSMPObjectColumns& objects, double dir_cos, double dir_sin, double range, double min_cos)
+{
+    typedef COSMPObjectColumns C;
+    const double* rel_x = objects.column(C::REL_X);
+    const double* rel_y = objects.column(C::REL_Y);
+    const double* distance = objects.column(C::DISTANCE);
+    uint32_t* selected = objects.selected();
+    size_t n = objects.size();
+    size_t found = 0;
+#if defined(OSMP_DETECTION_KERNEL_AVX2)
+    __m256d dc = _mm256_set1_pd(dir_cos), ds = _mm256_set1_pd(dir_sin), r = _mm256_set1_pd(range), mc = _mm256_set1_pd(min_cos);
+    for (size_t k = 0; k < n; k += 4) {
+        __m256d d = _mm256_load_pd(distance+k);
+        __m256d dir = _mm256_add_pd(_mm256_mul_pd(_mm256_load_pd(rel_x+k), dc), _mm256_mul_pd(_mm256_load_pd(rel_y+k), ds));
+        __m256d inside = _mm256_and_pd(_mm256_cmp_pd(d, r, _CMP_LE_OQ), _mm256_cmp_pd(_mm256_div_pd(dir, d), mc, _CMP_GT_OQ));
+        for (int mask = _mm256_movemask_pd(inside), lane = 0; mask != 0; mask >>= 1, lane++)
+            if ((mask & 1) && k + lane < n)
+                selected[found++] = (uint32_t)(k + lane);
+    }
+#elif defined(OSMP_DETECTION_KERNEL_SSE2)
+    __m128d dc = _mm_set1_pd(dir_cos), ds = _mm_set1_pd(dir_sin), r = _mm_set1_pd(range), mc = _mm_set1_pd(min_cos);
+    for (size_t k = 0; k < n; k += 2) {
+        __m128d d = _mm_load_pd(distance+k);
+        __m128d dir = _mm_add_pd(_mm_mul_pd(_mm_load_pd(rel_x+k), dc), _mm_mul_pd(_mm_load_pd(rel_y+k), ds));
+        __m128d inside = _mm_and_pd(_mm_cmple_pd(d, r), _mm_cmpgt_pd(_mm_div_pd(dir, d), mc));
+        for (int mask = _mm_movemask_pd(inside), lane = 0; mask != 0; mask >>= 1, lane++)
+            if ((mask & 1) && k + lane < n)
+                selected[found++] = (uint32_t)(k + lane);
+    }
+#else
+    for (size_t k = 0; k < n; k++)
+        if ((distance[k] <= range) && ((rel_x[k]*dir_cos + rel_y[k]*dir_sin)/distance[k] > min_cos))
+            selected[found++] = (uint32_t)k;
+#endif
+    return found;
+}
+
+#endif
@@ -0,0 +1,239 @@
+/*
+ * PMSF FMU Framework for FMI 2.0 Co-Simulation FMUs
+ *
+ * (C) 2016 -- 2018 PMSF IT Consulting Pierre R. Mai
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef OSMPGeometry_h
+#define OSMPGeometry_h
+
+/*
+ * Geometry Helpers
+ *
+ * Rotation matrices for osi3::Orientation3d values (yaw, then pitch,
+ * then roll), computed for whole arrays of orientations at once:
+ *
+ * - Sines and cosines come from a batched sincos, which evaluates the
+ *   Cephes polynomials two angles at a time with SSE2 (scalar code
+ *   elsewhere, with identical results).  It is accurate to about one
+ *   unit in the last place and exact for zero angles.
+ * - Orientations without pitch and roll, as for all road vehicles of
+ *   the dummy sources, only need the sine and cosine of the yaw.
+ * - COSMPRotationCache keeps the matrices of the previous frame per
+ *   object id and reuses them for objects whose orientation did not
+ *   change at all.
+ */
+
+#include <cstddef>
+#include <cstdint>
+#include <cmath>
+#include <vector>
+#include "OSMPAllocationCounter.h"
+#include "OSMPIdIndex.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define OSMP_GEOMETRY_SSE2
+#endif
+
+/* Beyond this the range reduction loses precision, libm takes over */
+#define OSMP_SINCOS_MAX 1.073741824e9
+
+/* Range reduction and polynomials of the Cephes sin/cos */
+#define OSMP_SINCOS_FOUR_OVER_PI 1.27323954473516268615
+#define OSMP_SINCOS_DP1 7.85398125648498535156E-1
+#define OSMP_SINCOS_DP2 3.77489470793079817668E-8
+#define OSMP_SINCOS_DP3 2.69515142907905952645E-15
+#define OSMP_SINCOS_S0 1.58962301576546568060E-10
+#define OSMP_SINCOS_S1 -2.50507477628578072866E-8
+#define OSMP_SINCOS_S2 2.75573136213857245213E-6
+#define OSMP_SINCOS_S3 -1.98412698295895385996E-4
+#define OSMP_SINCOS_S4 8.33333333332211858878E-3
+#define OSMP_SINCOS_S5 -1.66666666666666307295E-1
+#define OSMP_SINCOS_C0 -1.13585365213876817300E-11
+#define OSMP_SINCOS_C1 2.08757008419747316778E-9
+#define OSMP_SINCOS_C2 -2.75573141792967388112E-7
+#define OSMP_SINCOS_C3 2.48015872888517045348E-5
+#define OSMP_SINCOS_C4 -1.38888888888730564116E-3
+#define OSMP_SINCOS_C5 4.16666666666665929218E-2
+
+inline void osmp_sincos(double angle, double& s, double& c)
+{
+    double ax = fabs(angle);
+    if (!(ax <= OSMP_SINCOS_MAX)) {
+        s = sin(angle);
+        c = cos(angle);
+        return;
+    }
+    int j = (int)(ax * OSMP_SINCOS_FOUR_OVER_PI);
+    j = (j + 1) & ~1;
+    double y = (double)j;
+    double z = ((ax - y*OSMP_SINCOS_DP1) - y*OSMP_SINCOS_DP2) - y*OSMP_SINCOS_DP3;
+    double zz = z*z;
+    double ps = z + z*zz*(((((OSMP_SINCOS_S0*zz + OSMP_SINCOS_S1)*zz + OSMP_SINCOS_S2)*zz + OSMP_SINCOS_S3)*zz + OSMP_SINCOS_S4)*zz + OSMP_SINCOS_S5);
+    double pc = (1.0 - 0.5*zz) + zz*zz*(((((OSMP_SINCOS_C0*zz + OSMP_SINCOS_C1)*zz + OSMP_SINCOS_C2)*zz + OSMP_SINCOS_C3)*zz + OSMP_SINCOS_C4)*zz + OSMP_SINCOS_C5);
+    /* Octant (always even here) picks polynomial and sign */
+    int q = j & 7;
+    double sa = (q & 2) ? pc : ps;
+    double ca = (q & 2) ? ps : pc;
+    if (q & 4)
+        sa = -sa;
+    if (((q >> 1) ^ (q >> 2)) & 1)
+        ca = -ca;
+    s = std::signbit(angle) ? -sa : sa;
+    c = ca;
+}
+
+/* Sines and cosines of n angles */
+inline void osmp_sincos(size_t n, const double* angles, double* s, double* c)
+{
+    size_t k = 0;
+#if defined(OSMP_GEOMETRY_SSE2)
+    const __m128d sign_mask = _mm_set1_pd(-0.0);
+    const __m128i one = _mm_set1_epi32(1), two = _mm_set1_epi32(2), four = _mm_set1_epi32(4);
+    for (; k + 2 <= n; k += 2) {
+        __m128d x = _mm_loadu_pd(angles+k);
+        __m128d sign = _mm_and_pd(x, sign_mask);
+        __m128d ax = _mm_andnot_pd(sign_mask, x);
+        __m128i j = _mm_cvttpd_epi32(_mm_mul_pd(ax, _mm_set1_pd(OSMP_SINCOS_FOUR_OVER_PI)));
+        j = _mm_andnot_si128(one, _mm_add_epi32(j, one));
+        __m128d y = _mm_cvtepi32_pd(j);
+        __m128d z = _mm_sub_pd(_mm_sub_pd(_mm_sub_pd(ax, _mm_mul_pd(y, _mm_set1_pd(OSMP_SINCOS_DP1))), _mm_mul_pd(y, _mm_set1_pd(OSMP_SINCOS_DP2))), _mm_mul_pd(y, _mm_set1_pd(OSMP_SINCOS_DP3)));
+        __m128d zz = _mm_mul_pd(z, z);
+        __m128d p = _mm_add_pd(_mm_mul_pd(_mm_set1_pd(OSMP_SINCOS_S0), zz), _mm_set1_pd(OSMP_SINCOS_S1));
+        p = _mm_add_pd(_mm_mul_pd(p, zz), _mm_set1_pd(OSMP_SINCOS_S2));
+        p = _mm_add_pd(_mm_mul_pd(p, zz), _mm_set1_pd(OSMP_SINCOS_S3));
+        p = _mm_add_pd(_mm_mul_pd(p, zz), _mm_set1_pd(OSMP_SINCOS_S4));
+        p = _mm_add_pd(_mm_mul_pd(p, zz), _mm_set1_pd(OSMP_SINCOS_S5));
+        __m128d ps = _mm_add_pd(z, _mm_mul_pd(_mm_mul_pd(z, zz), p));
+        p = _mm_add_pd(_mm_mul_pd(_mm_set1_pd(OSMP_SINCOS_C0), zz), _mm_set1_pd(OSMP_SINCOS_C1));
+        p = _mm_add_pd(_mm_mul_pd(p, zz), _mm_set1_pd(OSMP_SINCOS_C2));
+        p = _mm_add_pd(_mm_mul_pd(p, zz), _mm_set1_pd(OSMP_SINCOS_C3));
+        p = _mm_add_pd(_mm_mul_pd(p, zz), _mm_set1_pd(OSMP_SINCOS_C4));
+        p = _mm_add_pd(_mm_mul_pd(p, zz), _mm_set1_pd(OSMP_SINCOS_C5));
+        __m128d pc = _mm_add_pd(_mm_sub_pd(_mm_set1_pd(1.0), _mm_mul_pd(_mm_set1_pd(0.5), zz)), _mm_mul_pd(_mm_mul_pd(zz, zz), p));
+        /* Spread the octant of each lane over both of its 32 bit halves, for 64 bit masks */
+        __m128i q = _mm_shuffle_epi32(j, _MM_SHUFFLE(1,1,0,0));
+        __m128d swap = _mm_castsi128_pd(_mm_cmpeq_epi32(_mm_and_si128(q, two), two));
+        __m128d sin_negate = _mm_castsi128_pd(_mm_cmpeq_epi32(_mm_and_si128(q, four), four));
+        __m128d cos_negate = _mm_castsi128_pd(_mm_cmpeq_epi32(_mm_and_si128(_mm_xor_si128(_mm_srli_epi32(q, 1), _mm_srli_epi32(q, 2)), one), one));
+        __m128d sa = _mm_or_pd(_mm_and_pd(swap, pc), _mm_andnot_pd(swap, ps));
+        __m128d ca = _mm_or_pd(_mm_and_pd(swap, ps), _mm_andnot_pd(swap, pc));
+        _mm_storeu_pd(s+k, _mm_xor_pd(_mm_xor_pd(sa, _mm_and_pd(sin_negate, sign_mask)), sign));
+        _mm_storeu_pd(c+k, _mm_xor_pd(ca, _mm_and_pd(cos_negate, sign_mask)));
+        if (_mm_movemask_pd(_mm_cmple_pd(ax, _mm_set1_pd(OSMP_SINCOS_MAX))) != 3) {
+            osmp_sincos(angles[k], s[k], c[k]);
+            osmp_sincos(angles[k+1], s[k+1], c[k+1]);
+        }
+    }
+#endif
+    for (; k < n; k++)
+        osmp_sincos(angles[k], s[k], c[k]);
+}
+
+/* Rotation matrix, row by row, from the sines and cosines of an orientation */
+inline void osmp_rotation_matrix(double sin_yaw, double cos_yaw, double sin_pitch, double cos_pitch, double sin_roll, double cos_roll, double* m)
+{
+    m[0] = cos_yaw*cos_pitch;  m[1] = cos_yaw*sin_pitch*sin_roll - sin_yaw*cos_roll; m[2] = cos_yaw*sin_pitch*cos_roll + sin_yaw*sin_roll;
+    m[3] = sin_yaw*cos_pitch;  m[4] = sin_yaw*sin_pitch*sin_roll + cos_yaw*cos_roll; m[5] = sin_yaw*sin_pitch*cos_roll - cos_yaw*sin_roll;
+    m[6] = -sin_pitch;         m[7] = cos_pitch*sin_roll;                            m[8] = cos_pitch*cos_roll;
+}
+
+/* Rotation matrix of an orientation without pitch and roll */
+inline void osmp_rotation_matrix(double sin_yaw, double cos_yaw, double* m)
+{
+    m[0] = cos_yaw;  m[1] = -sin_yaw; m[2] = 0.0;
+    m[3] = sin_yaw;  m[4] = cos_yaw;  m[5] = 0.0;
+    m[6] = 0.0;      m[7] = 0.0;      m[8] = 1.0;
+}
+
+class COSMPRotationCache {
+public:
+    COSMPRotationCache() : current(0) {}
+
+    /*
+     * Fills m[0] to m[8] (the matrix rows, one array per element) with
+     * the rotation matrices of n objects, given their ids and
+     * orientations, and remembers them for the next call.
+     */
+    void rotate(size_t n, const uint64_t* ids, const double* yaw, const double* pitch, const double* roll, double* const m[9])
+    {
+        int previous = current;
+        current ^= 1;
+        COSMPIdIndex& index = indices[current];
+        COSMPCountedVector<Entry>& entries = frames[current];
+        index.clear();
+        entries.resize(n);
+        yawOnly.clear();
+        general.clear();
+        for (size_t k = 0; k < n; k++) {
+            Entry& entry = entries[k];
+            entry.yaw = yaw[k];
+            entry.pitch = pitch[k];
+            entry.roll = roll[k];
+            size_t last = indices[previous].find(ids[k]);
+            const Entry* before = (last == COSMPIdIndex::npos) ? NULL : &frames[previous][last];
+            if (before != NULL && before->yaw == entry.yaw && before->pitch == entry.pitch && before->roll == entry.roll)
+                for (int i = 0; i < 9; i++)
+                    entry.m[i] = before->m[i];
+            else if (entry.pitch == 0.0 && entry.roll == 0.0)
+                yawOnly.push_back(k);
+            else
+                general.push_back(k);
+            index.insert(ids[k], k);
+        }
+        if (!yawOnly.empty()) {
+            size_t count = yawOnly.size();
+            reserve(count);
+            for (size_t i = 0; i < count; i++)
+                angles[i] = entries[yawOnly[i]].yaw;
+            osmp_sincos(count, &angles[0], &sines[0], &cosines[0]);
+            for (size_t i = 0; i < count; i++)
+                osmp_rotation_matrix(sines[i], cosines[i], entries[yawOnly[i]].m);
+        }
+        if (!general.empty()) {
+            size_t count = general.size();
+            reserve(3*count);
+            for (size_t i = 0; i < count; i++) {
+                angles[i] = entries[general[i]].yaw;
+                angles[count+i] = entries[general[i]].pitch;
+                angles[2*count+i] = entries[general[i]].roll;
+            }
+            osmp_sincos(3*count, &angles[0], &sines[0], &cosines[0]);
+            for (size_t i = 0; i < count; i++)
+                osmp_rotation_matrix(sines[i], cosines[i], sines[count+i], cosines[count+i], sines[2*count+i], cosines[2*count+i], entries[general[i]].m);
+        }
+        for (size_t k = 0; k < n; k++)
+            for (int i = 0; i < 9; i++)
+                m[i][k] = entries[k].m[i];
+    }
+
+private:
+    struct Entry {
+        double yaw, pitch, roll;
+        double m[9];
+    };
+
+    void reserve(size_t count)
+    {
+        if (angles.size() < count) {
+            angles.resize(count);
+            sines.resize(count);
+            cosines.resize(count);
+        }
+    }
+
+    /* Matrices of the current and the previous frame, by id */
+    int current;
+    COSMPIdIndex indices[2];
+    COSMPCountedVector<Entry> frames[2];
+    /* Scratch space, reused */
+    COSMPCountedVector<size_t> yawOnly, general;
+    COSMPCountedVector<double> angles, sines, cosines;
+};
+
+#endif
@@ -0,0 +1,141 @@
+/*
+ * PMSF FMU Framework for FMI 2.0 Co-Simulation FMUs
+ *
+ * (C) 2016 -- 2018 PMSF IT Consulting Pierre R. Mai
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef OSMPIdIndex_h
+#define OSMPIdIndex_h
+
+/*
+ * Identifier Index
+ *
+ * Maps OSI identifier values to the positions of the objects carrying
+ * them, e.g. within the moving objects of a ground truth, so that
+ * cross-references can be resolved without scanning all objects.  It
+ * is an open-addressing hash table with linear probing, meant to be
+ * cleared and refilled every step: clearing only advances a stamp, and
+ * the storage only ever grows, so that a refilled index does not
+ * touch the heap once it has reached its size.
+ */
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "OSMPAllocationCounter.h"
+
+class COSMPIdIndex {
+public:
+    static const size_t npos = (size_t)-1;
+
+    COSMPIdIndex() : count(0), stamp(1) {}
+
+    size_t size() const { return count; }
+
+    /* Forgets all entries */
+    void clear()
+    {
+        count = 0;
+        if (++stamp == 0) {
+            /* Stamp wrapped around, old entries could look current again */
+            for (size_t i = 0; i < slots.size(); i++)
+                slots[i].stamp = 0;
+            stamp = 1;
+        }
+    }
+
+    /* Maps id to index, replacing any earlier index for the same id */
+    void insert(uint64_t id, size_t index)
+    {
+        if ((count + 1) * 2 > slots.size())
+            grow();
+        Slot& slot = slots[probe(id)];
+        if (slot.stamp != stamp) {
+            slot.stamp = stamp;
+            slot.id = id;
+            count++;
+        }
+        slot.index = index;
+    }
+
+    /* Forgets the entry for id, if any */
+    void erase(uint64_t id)
+    {
+        if (count == 0)
+            return;
+        size_t mask = slots.size() - 1;
+        size_t gap = probe(id);
+        if (slots[gap].stamp != stamp)
+            return;
+        /* Moves up later entries whose probe sequence passes the gap, so that all stay reachable */
+        for (size_t i = (gap + 1) & mask; slots[i].stamp == stamp; i = (i + 1) & mask) {
+            size_t home = hash(slots[i].id) & mask;
+            if (((i - home) & mask) >= ((i - gap) & mask)) {
+                slots[gap] = slots[i];
+                gap = i;
+            }
+        }
+        slots[gap].stamp = 0;
+        count--;
+    }
+
+    /* Index last inserted for id, or npos */
+    size_t find(uint64_t id) const
+    {
+        if (count == 0)
+            return npos;
+        const Slot& slot = slots[probe(id)];
+        return slot.stamp == stamp ? slot.index : npos;
+    }
+
+private:
+    struct Slot {
+        uint64_t id;
+        size_t index;
+        uint32_t stamp;
+    };
+
+    /* Finalizer of SplitMix64, OSI ids are often small and sequential */
+    static size_t hash(uint64_t id)
+    {
+        id ^= id >> 30;
+        id *= 0xBF58476D1CE4E5B9ULL;
+        id ^= id >> 27;
+        id *= 0x94D049BB133111EBULL;
+        id ^= id >> 31;
+        return (size_t)id;
+    }
+
+    /* Slot holding id, or the free slot where it would go */
+    size_t probe(uint64_t id) const
+    {
+        size_t mask = slots.size() - 1;
+        size_t i = hash(id) & mask;
+        while (slots[i].stamp == stamp && slots[i].id != id)
+            i = (i + 1) & mask;
+        return i;
+    }
+
+    void grow()
+    {
+        COSMPCountedVector<Slot> old;
+        old.swap(slots);
+        Slot empty = { 0, 0, 0 };
+        slots.assign(old.empty() ? 16 : old.size() * 2, empty);
+        for (size_t i = 0; i < old.size(); i++)
+            if (old[i].stamp == stamp) {
+                Slot& slot = slots[probe(old[i].id)];
+                slot = old[i];
+            }
+    }
+
+    size_t count;
+    uint32_t stamp;
+    COSMPCountedVector<Slot> slots;
+};
+
+#endif
@@ -0,0 +1,162 @@
+/*
+ * PMSF FMU Framework for FMI 2.0 Co-Simulation FMUs
+ *
+ * (C) 2016 -- 2018 PMSF IT Consulting Pierre R. Mai
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef OSMPOcclusionBuffer_h
+#define OSMPOcclusionBuffer_h
+
+/*
+ * Occlusion Buffer
+ *
+ * One-dimensional angular depth buffer around a sensor, which tells
+ * how much of each object is hidden behind nearer objects.  Objects
+ * are added as spans of horizontal angles with the distances of their
+ * nearest and farthest points; resolve() then rasterizes all spans
+ * into the buffer at their farthest distance, keeping the nearest one
+ * per bin, and counts the bins of every span that nothing lies in
+ * front of its nearest point in.  An object thus only hides what lies
+ * wholly behind it, also where it is seen at a slant.  Objects that
+ * only hide others are added as occluders, whose visibility is not
+ * calculated.  This takes time linear in the number of objects and
+ * bins covered, no sorting is needed, and the storage only ever grows.
+ */
+
+#include <cstddef>
+#include <cmath>
+#include <vector>
+
+class COSMPOcclusionBuffer {
+public:
+    explicit COSMPOcclusionBuffer(size_t bins = 1024) : depths(bins), scale(0.0), limit(0.0) {}
+
+    /* Starts a new buffer covering the angles from -half_angle to half_angle */
+    void begin(double half_angle)
+    {
+        spans.clear();
+        occluders.clear();
+        limit = half_angle;
+        scale = depths.size() / (2.0*half_angle);
+    }
+
+    /* Adds an object covering the angles from lo to hi between the depths nearest and farthest, returns its index */
+    size_t add(double lo, double hi, double nearest, double farthest)
+    {
+        Span span;
+        span.first = bin(lo);
+        span.last = bin(hi);
+        span.nearest = nearest;
+        span.farthest = farthest;
+        span.visible = 1.0;
+        spans.push_back(span);
+        return spans.size() - 1;
+    }
+
+    /* Adds an object that only hides others, unless it lies wholly beside the buffer */
+    void add_occluder(double lo, double hi, double farthest)
+    {
+        if (hi < -limit || lo > limit)
+            return;
+        Span span;
+        span.first = bin(lo);
+        span.last = bin(hi);
+        span.nearest = span.farthest = farthest;
+        span.visible = 1.0;
+        occluders.push_back(span);
+    }
+
+    /* Calculates the visibility of all objects added */
+    void resolve()
+    {
+        for (size_t b = 0; b < depths.size(); b++)
+            depths[b] = HUGE_VAL;
+        draw(spans);
+        draw(occluders);
+        for (size_t i = 0; i < spans.size(); i++) {
+            size_t visible = 0;
+            for (size_t b = spans[i].first; b <= spans[i].last; b++)
+                if (!(depths[b] < spans[i].nearest))
+                    visible++;
+            spans[i].visible = (double)visible / (spans[i].last - spans[i].first + 1);
+        }
+    }
+
+    /* Fraction of an object not hidden behind nearer ones, 0 if fully occluded */
+    double visibility(size_t index) const { return spans[index].visible; }
+
+private:
+    struct Span {
+        size_t first, last;
+        double nearest, farthest;
+        double visible;
+    };
+
+    void draw(const std::vector<Span>& drawn)
+    {
+        for (size_t i = 0; i < drawn.size(); i++)
+            for (size_t b = drawn[i].first; b <= drawn[i].last; b++)
+                if (drawn[i].farthest < depths[b])
+                    depths[b] = drawn[i].farthest;
+    }
+
+    /* Angles beyond the buffer are clamped to its edges */
+    size_t bin(double angle) const
+    {
+        double b = floor((angle + limit) * scale);
+        if (!(b > 0.0))
+            return 0;
+        if (b >= depths.size())
+            return depths.size() - 1;
+        return (size_t)b;
+    }
+
+    std::vector<double> depths;
+    std::vector<Span> spans;
+    std::vector<Span> occluders;
+    double scale;
+    double limit;
+};
+
+/*
+ * Horizontal angles, relative to the direction (dir_cos, dir_sin), of
+ * the corners of a bounding box centered at (x, y) relative to the
+ * sensor, with the half axes (lx, ly) along its length and (wx, wy)
+ * along its width, and the distances of its nearest and farthest
+ * corners.  Boxes reaching around behind the sensor cover all angles.
+ */
+inline void osmp_box_span(double x, double y, double lx, double ly, double wx, double wy, double dir_cos, double dir_sin, double& lo, double& hi, double& nearest, double& farthest)
+{
+    const double corners[4][2] = {
+        { x + lx + wx, y + ly + wy }, { x + lx - wx, y + ly - wy },
+        { x - lx + wx, y - ly + wy }, { x - lx - wx, y - ly - wy }
+    };
+    lo = HUGE_VAL;
+    hi = -HUGE_VAL;
+    nearest = HUGE_VAL;
+    farthest = 0.0;
+    for (int i = 0; i < 4; i++) {
+        double forward = corners[i][0]*dir_cos + corners[i][1]*dir_sin;
+        double left = corners[i][1]*dir_cos - corners[i][0]*dir_sin;
+        double angle = atan2(left, forward);
+        if (angle < lo)
+            lo = angle;
+        if (angle > hi)
+            hi = angle;
+        double d = sqrt(forward*forward + left*left);
+        if (d < nearest)
+            nearest = d;
+        if (d > farthest)
+            farthest = d;
+    }
+    if (!(hi - lo < 3.141592653589793)) {
+        lo = -HUGE_VAL;
+        hi = HUGE_VAL;
+    }
+}
+
+#endif
@@ -0,0 +1,266 @@
+/*
+ * PMSF FMU Framework for FMI 2.0 Co-Simulation FMUs
+ *
+ * (C) 2016 -- 2018 PMSF IT Consulting Pierre R. Mai
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef OSMPSharedMemory_h
+#define OSMPSharedMemory_h
+
+/*
+ * Shared Memory Transport
+ *
+ * Alternative to passing raw pointers through binary variables, for
+ * hosts that run in a different process than the model.  The model
+ * places its output buffers in a named POSIX shared memory region,
+ * and the binary variable carries the offset of the buffer in the
+ * region (base.lo), a generation counter (base.hi) and the size.
+ *
+ * Every buffer is preceded by a slot header repeating its generation,
+ * which is odd while the buffer is being rewritten.  Readers check the
+ * slot generation after reading a buffer to detect that it has been
+ * reused meanwhile.  The writer reserves the address space for the
+ * maximum region size once and only grows the backing store, so that
+ * buffers stay put while several outputs are written concurrently.
+ * Readers map the same reservation, so buffers stay put for them as
+ * well.
+ */
+
+#ifdef _WIN32
+#error "Shared memory transport requires POSIX shared memory"
+#endif
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define OSMP_SHARED_MEMORY_MAGIC 0x504D534FU
+#define OSMP_SHARED_MEMORY_VERSION 1
+
+/* Start of the region */
+struct OSMPSharedMemoryHeader {
+    uint32_t magic;
+    uint32_t version;
+    /* Maximum size of the region */
+    uint64_t reserved;
+    /* End of the part of the region handed out to buffers so far */
+    uint64_t used;
+};
+
+/* Precedes every buffer in the region */
+struct OSMPSharedMemorySlotHeader {
+    uint32_t generation;
+    uint32_t reserved;
+    uint64_t size;
+};
+
+/* Writer-side bookkeeping for one buffer, offset 0 if not yet placed */
+struct OSMPSharedMemorySlot {
+    uint32_t offset;
+    uint32_t capacity;
+    uint32_t generation;
+};
+
+class COSMPSharedMemoryWriter {
+public:
+    COSMPSharedMemoryWriter() : fd(-1), base(NULL), reserved(0), backed(0) {}
+    ~COSMPSharedMemoryWriter() { close(); }
+
+    bool is_open() const { return base != NULL; }
+    const std::string& name() const { return regionName; }
+
+    /* Creates a new region, reserving address space for size bytes */
+    bool open(const std::string& name, size_t size)
+    {
+        close();
+        if (size > INT32_MAX)
+            size = INT32_MAX;
+        fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+        if (fd < 0)
+            return false;
+        regionName = name;
+        void* mapping = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (mapping == MAP_FAILED || !grow(sizeof(OSMPSharedMemoryHeader))) {
+            if (mapping != MAP_FAILED)
+                munmap(mapping, size);
+            close();
+            return false;
+        }
+        base = static_cast<uint8_t*>(mapping);
+        reserved = size;
+        header()->magic = OSMP_SHARED_MEMORY_MAGIC;
+        header()->version = OSMP_SHARED_MEMORY_VERSION;
+        header()->reserved = size;
+        __atomic_store_n(&header()->used, (uint64_t)sizeof(OSMPSharedMemoryHeader), __ATOMIC_RELEASE);
+        return true;
+    }
+
+    /* Unmaps and unlinks the region, readers keep their mappings */
+    void close()
+    {
+        if (base != NULL)
+            munmap(base, reserved);
+        if (fd >= 0) {
+            ::close(fd);
+            shm_unlink(regionName.c_str());
+        }
+        fd = -1;
+        base = NULL;
+        reserved = backed = 0;
+        regionName.clear();
+    }
+
+    /*
+     * Marks the slot as being rewritten and returns where to write its
+     * new content of the given size, moving the slot to a larger place
+     * in the region if needed.  Returns NULL if the region is full.
+     * Slots may be written concurrently, as long as each slot is only
+     * written by one thread at a time.
+     */
+    uint8_t* begin_write(OSMPSharedMemorySlot& slot, size_t size)
+    {
+        if (slot.offset == 0 || slot.capacity < size) {
+            /* Abandoned places are never reused, so old readers stay valid */
+            std::lock_guard<std::mutex> guard(allocation);
+            uint64_t capacity = ((uint64_t)size + size/2 + 7) & ~(uint64_t)7;
+            uint64_t offset = header()->used + sizeof(OSMPSharedMemorySlotHeader);
+            if (offset + capacity > reserved || !grow(offset + capacity))
+                return NULL;
+            __atomic_store_n(&header()->used, offset + capacity, __ATOMIC_RELEASE);
+            slot.offset = (uint32_t)offset;
+            slot.capacity = (uint32_t)capacity;
+        }
+        OSMPSharedMemorySlotHeader* slot_header = reinterpret_cast<OSMPSharedMemorySlotHeader*>(base + slot.offset) - 1;
+        __atomic_store_n(&slot_header->generation, slot.generation + 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+        return base + slot.offset;
+    }
+
+    /* Publishes the content written, returning its new generation */
+    uint32_t end_write(OSMPSharedMemorySlot& slot, size_t size)
+    {
+        OSMPSharedMemorySlotHeader* slot_header = reinterpret_cast<OSMPSharedMemorySlotHeader*>(base + slot.offset) - 1;
+        slot.generation += 2;
+        slot_header->size = size;
+        __atomic_store_n(&slot_header->generation, slot.generation, __ATOMIC_RELEASE);
+        return slot.generation;
+    }
+
+private:
+    COSMPSharedMemoryWriter(const COSMPSharedMemoryWriter&);
+    COSMPSharedMemoryWriter& operator=(const COSMPSharedMemoryWriter&);
+
+    OSMPSharedMemoryHeader* header() { return reinterpret_cast<OSMPSharedMemoryHeader*>(base); }
+
+    /* Grows the backing store geometrically to at least size bytes */
+    bool grow(uint64_t size)
+    {
+        if (size <= backed)
+            return true;
+        uint64_t target = backed * 2 > size ? backed * 2 : size;
+        if (reserved > 0 && target > reserved)
+            target = reserved;
+        if (ftruncate(fd, (off_t)target) != 0)
+            return false;
+        backed = (size_t)target;
+        return true;
+    }
+
+    int fd;
+    uint8_t* base;
+    size_t reserved;
+    size_t backed;
+    std::string regionName;
+    std::mutex allocation;
+};
+
+class COSMPSharedMemoryReader {
+public:
+    COSMPSharedMemoryReader() : fd(-1), base(NULL), reserved(0) {}
+    ~COSMPSharedMemoryReader() { close(); }
+
+    bool open(const std::string& name)
+    {
+        close();
+        fd = shm_open(name.c_str(), O_RDONLY, 0);
+        if (fd < 0)
+            return false;
+        /* Map the header alone first to learn the size of the reservation */
+        struct stat info;
+        if (fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(OSMPSharedMemoryHeader)) {
+            close();
+            return false;
+        }
+        void* mapping = mmap(NULL, sizeof(OSMPSharedMemoryHeader), PROT_READ, MAP_SHARED, fd, 0);
+        if (mapping == MAP_FAILED) {
+            close();
+            return false;
+        }
+        OSMPSharedMemoryHeader region = *static_cast<const OSMPSharedMemoryHeader*>(mapping);
+        munmap(mapping, sizeof(OSMPSharedMemoryHeader));
+        if (region.magic != OSMP_SHARED_MEMORY_MAGIC || region.version != OSMP_SHARED_MEMORY_VERSION) {
+            close();
+            return false;
+        }
+        mapping = mmap(NULL, (size_t)region.reserved, PROT_READ, MAP_SHARED, fd, 0);
+        if (mapping == MAP_FAILED) {
+            close();
+            return false;
+        }
+        base = static_cast<const uint8_t*>(mapping);
+        reserved = (size_t)region.reserved;
+        return true;
+    }
+
+    void close()
+    {
+        if (base != NULL)
+            munmap(const_cast<uint8_t*>(base), reserved);
+        if (fd >= 0)
+            ::close(fd);
+        fd = -1;
+        base = NULL;
+        reserved = 0;
+    }
+
+    /*
+     * Returns the buffer given by the values of a binary variable, or
+     * NULL if it is out of range or has already been reused.
+     */
+    const uint8_t* get(uint32_t offset, uint32_t generation, size_t size)
+    {
+        if (base == NULL || offset < sizeof(OSMPSharedMemoryHeader) + sizeof(OSMPSharedMemorySlotHeader))
+            return NULL;
+        uint64_t used = __atomic_load_n(&reinterpret_cast<const OSMPSharedMemoryHeader*>(base)->used, __ATOMIC_ACQUIRE);
+        if ((uint64_t)offset + size > used || !valid(offset, generation))
+            return NULL;
+        return base + offset;
+    }
+
+    /* True if the buffer was not rewritten since it was provided */
+    bool valid(uint32_t offset, uint32_t generation) const
+    {
+        const OSMPSharedMemorySlotHeader* slot_header = reinterpret_cast<const OSMPSharedMemorySlotHeader*>(base + offset) - 1;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        return __atomic_load_n(&slot_header->generation, __ATOMIC_ACQUIRE) == generation;
+    }
+
+private:
+    COSMPSharedMemoryReader(const COSMPSharedMemoryReader&);
+    COSMPSharedMemoryReader& operator=(const COSMPSharedMemoryReader&);
+
+    int fd;
+    const uint8_t* base;
+    size_t reserved;
+};
+
+#endif
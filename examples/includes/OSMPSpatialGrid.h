@@ -0,0 +1,199 @@
+/*
+ * PMSF FMU Framework for FMI 2.0 Co-Simulation FMUs
+ *
+ * (C) 2016 -- 2018 PMSF IT Consulting Pierre R. Mai
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef OSMPSpatialGrid_h
+#define OSMPSpatialGrid_h
+
+/*
+ * Spatial Grid
+ *
+ * Uniform grid over the x/y plane, hashed so that it covers any area,
+ * which finds the objects near a point without looking at all of them.
+ * It is kept up to date frame by frame: objects are matched to the
+ * previous frame by id, and only objects that moved to another cell,
+ * appeared or disappeared change the grid.  Cells left empty at the
+ * end of a frame are recycled for the cells entered later, so that the
+ * storage stays bounded by the area occupied at a time rather than the
+ * area ever visited.  Queries return candidates only, i.e. every object
+ * within the radius and some more, so callers still apply their exact
+ * test.
+ */
+
+#include <cstddef>
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+#include <vector>
+#include "OSMPAllocationCounter.h"
+#include "OSMPIdIndex.h"
+
+class COSMPSpatialGrid {
+public:
+    explicit COSMPSpatialGrid(double cell_size = 50.0) : cellSize(cell_size), current(0), frame(0) {}
+
+    /* Starts a new frame, to be followed by update() for all its objects and end_update() */
+    void begin_update()
+    {
+        current ^= 1;
+        handles[current].clear();
+        frame++;
+    }
+
+    /* Reports the position of an object and its index in the current frame */
+    void update(uint64_t id, uint32_t index, double x, double y)
+    {
+        int32_t cx = cell_coordinate(x), cy = cell_coordinate(y);
+        size_t handle = handles[current ^ 1].find(id);
+        if (handle == COSMPIdIndex::npos || objects[handle].frame == frame) {
+            /* New object, or another one with the same id in this frame */
+            if (unused.empty()) {
+                handle = objects.size();
+                objects.push_back(Object());
+            } else {
+                handle = unused.back();
+                unused.pop_back();
+            }
+            objects[handle].live = true;
+            insert(handle, cx, cy);
+        } else if (objects[handle].cx != cx || objects[handle].cy != cy) {
+            remove(handle);
+            insert(handle, cx, cy);
+        }
+        objects[handle].index = index;
+        objects[handle].frame = frame;
+        handles[current].insert(id, handle);
+    }
+
+    /* Drops the objects that were not reported in this frame, and the cells left empty */
+    void end_update()
+    {
+        for (size_t handle = 0; handle < objects.size(); handle++)
+            if (objects[handle].live && objects[handle].frame != frame) {
+                remove(handle);
+                objects[handle].live = false;
+                unused.push_back((uint32_t)handle);
+            }
+        for (size_t i = 0; i < emptied.size(); i++) {
+            uint32_t cell = emptied[i];
+            /* Cells emptied twice are listed twice, but only dropped once */
+            if (cells[cell].members.empty() && cellIndex.find(cells[cell].key) == cell) {
+                cellIndex.erase(cells[cell].key);
+                unusedCells.push_back(cell);
+            }
+        }
+        emptied.clear();
+    }
+
+    /* Sets indices to the candidates within radius of (x, y), in ascending order */
+    void query(double x, double y, double radius, COSMPCountedVector<uint32_t>& indices) const
+    {
+        indices.clear();
+        /* Margin for rounding in the exact test of the caller */
+        radius += radius*1e-6 + 1e-6;
+        int32_t cx_min = cell_coordinate(x - radius), cx_max = cell_coordinate(x + radius);
+        int32_t cy_min = cell_coordinate(y - radius), cy_max = cell_coordinate(y + radius);
+        for (int64_t cx = cx_min; cx <= cx_max; cx++)
+            for (int64_t cy = cy_min; cy <= cy_max; cy++) {
+                size_t cell = cellIndex.find(cell_key((int32_t)cx, (int32_t)cy));
+                if (cell == COSMPIdIndex::npos)
+                    continue;
+                const COSMPCountedVector<uint32_t>& members = cells[cell].members;
+                for (size_t i = 0; i < members.size(); i++)
+                    indices.push_back(objects[members[i]].index);
+            }
+        std::sort(indices.begin(), indices.end());
+    }
+
+private:
+    struct Object {
+        Object() : cx(0), cy(0), cell(0), slot(0), index(0), frame(0), live(false) {}
+        int32_t cx, cy;
+        /* Cell and position within its members */
+        uint32_t cell, slot;
+        /* Position in the current frame */
+        uint32_t index;
+        unsigned long long frame;
+        bool live;
+    };
+
+    struct Cell {
+        uint64_t key;
+        /* Handles of the objects in the cell */
+        COSMPCountedVector<uint32_t> members;
+    };
+
+    /*
+     * Far away or invalid coordinates are clamped, which can only merge
+     * cells and thus adds candidates, but never loses any.
+     */
+    int32_t cell_coordinate(double v) const
+    {
+        double c = floor(v / cellSize);
+        if (!(c > -1073741824.0))
+            return -1073741824;
+        if (!(c < 1073741824.0))
+            return 1073741824;
+        return (int32_t)c;
+    }
+
+    static uint64_t cell_key(int32_t cx, int32_t cy)
+    {
+        return ((uint64_t)(uint32_t)cx << 32) | (uint32_t)cy;
+    }
+
+    void insert(size_t handle, int32_t cx, int32_t cy)
+    {
+        uint64_t key = cell_key(cx, cy);
+        size_t cell = cellIndex.find(key);
+        if (cell == COSMPIdIndex::npos) {
+            if (unusedCells.empty()) {
+                cell = cells.size();
+                cells.push_back(Cell());
+            } else {
+                cell = unusedCells.back();
+                unusedCells.pop_back();
+            }
+            cells[cell].key = key;
+            cellIndex.insert(key, cell);
+        }
+        Object& object = objects[handle];
+        object.cx = cx;
+        object.cy = cy;
+        object.cell = (uint32_t)cell;
+        object.slot = (uint32_t)cells[cell].members.size();
+        cells[cell].members.push_back((uint32_t)handle);
+    }
+
+    void remove(size_t handle)
+    {
+        COSMPCountedVector<uint32_t>& members = cells[objects[handle].cell].members;
+        uint32_t moved = members.back();
+        members[objects[handle].slot] = moved;
+        objects[moved].slot = objects[handle].slot;
+        members.pop_back();
+        if (members.empty())
+            emptied.push_back(objects[handle].cell);
+    }
+
+    double cellSize;
+    /* Handles of the objects by id, for the current and the previous frame */
+    int current;
+    COSMPIdIndex handles[2];
+    unsigned long long frame;
+    COSMPCountedVector<Object> objects;
+    COSMPCountedVector<uint32_t> unused;
+    /* Cells by key, the cells emptied in this frame and those free for reuse */
+    COSMPIdIndex cellIndex;
+    COSMPCountedVector<Cell> cells;
+    COSMPCountedVector<uint32_t> emptied;
+    COSMPCountedVector<uint32_t> unusedCells;
+};
+
+#endif
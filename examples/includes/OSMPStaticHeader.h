@@ -0,0 +1,83 @@
+/*
+ * PMSF FMU Framework for FMI 2.0 Co-Simulation FMUs
+ *
+ * (C) 2016 -- 2018 PMSF IT Consulting Pierre R. Mai
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef OSMPStaticHeader_h
+#define OSMPStaticHeader_h
+
+/*
+ * Static Header
+ *
+ * The leading fields of an OSI top-level message, e.g. a SensorView or
+ * SensorData, of which only the timestamp changes from step to step:
+ * the interface version, which is resolved only once, and fields like
+ * sensor or host vehicle ids or the mounting position.  These fields
+ * are encoded once per instance, in two parts around the timestamp,
+ * so that the header written for a step keeps the field order of the
+ * serialized message tree.  The rest of the message, with higher field
+ * numbers, follows the header.
+ */
+
+#include <cstddef>
+#include <cstdint>
+#include <cmath>
+#include <string>
+#include "osi_version.pb.h"
+#include "osi_common.pb.h"
+#include "OSMPWireFormat.h"
+
+/* Writes a Timestamp field for time in seconds */
+inline void osmp_write_timestamp(COSMPWireWriter& out, uint32_t field, double time)
+{
+    size_t mark = out.begin_message(field);
+    out.write_varint(osi3::Timestamp::kSecondsFieldNumber, (uint64_t)(int64_t)floor(time));
+    out.write_varint(osi3::Timestamp::kNanosFieldNumber, (uint32_t)(int)((time - floor(time))*1000000000.0));
+    out.end_message(mark);
+}
+
+class COSMPStaticHeader {
+public:
+    COSMPStaticHeader(uint32_t version_field, uint32_t timestamp_field) : timestampField(timestamp_field)
+    {
+        const osi3::InterfaceVersion& version = osi3::InterfaceVersion::descriptor()->file()->options().GetExtension(osi3::current_interface_version);
+        std::string encoded = version.SerializeAsString();
+        before.write_bytes(version_field, encoded.data(), encoded.size());
+    }
+
+    /* Adds an identifier field, numbered above the timestamp and any field added before */
+    void add_identifier(uint32_t field, uint64_t value)
+    {
+        size_t mark = after.begin_message(field);
+        after.write_varint(osi3::Identifier::kValueFieldNumber, value);
+        after.end_message(mark);
+    }
+
+    /* Adds a submessage field, e.g. a mounting position, numbered as for add_identifier() */
+    void add_message(uint32_t field, const google::protobuf::MessageLite& message)
+    {
+        std::string encoded = message.SerializeAsString();
+        after.write_bytes(field, encoded.data(), encoded.size());
+    }
+
+    /* Appends the header of the step at time to out */
+    void write(COSMPWireWriter& out, double time) const
+    {
+        out.append(before.data(), before.size());
+        osmp_write_timestamp(out, timestampField, time);
+        out.append(after.data(), after.size());
+    }
+
+private:
+    uint32_t timestampField;
+    /* Encoded fields numbered below and above the timestamp */
+    COSMPWireWriter before;
+    COSMPWireWriter after;
+};
+
+#endif
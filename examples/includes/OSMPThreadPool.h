@@ -0,0 +1,160 @@
+/*
+ * PMSF FMU Framework for FMI 2.0 Co-Simulation FMUs
+ *
+ * (C) 2016 -- 2018 PMSF IT Consulting Pierre R. Mai
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef OSMPThreadPool_h
+#define OSMPThreadPool_h
+
+/*
+ * Internal Thread Pool
+ *
+ * A small fixed set of worker threads owned by one FMU instance, for
+ * fanning out independent per-step work (e.g. decoding several inputs)
+ * and joining it again before the step continues.  The calling thread
+ * always takes part in the work, so a pool without workers simply runs
+ * everything inline.  Only one batch can be in flight at a time, and
+ * starting or waiting for batches is restricted to the thread that
+ * drives the FMU instance, as FMI requires anyway.  Tasks must not
+ * call back into the FMI logger, which is not guaranteed thread-safe.
+ */
+
+#include <cstddef>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class COSMPThreadPool {
+public:
+    explicit COSMPThreadPool(unsigned int workers = 0)
+        : generation(0), finished(workers), stopping(false), batchFunction(NULL), batchContext(NULL), batchCount(0), nextIndex(0)
+    {
+        for (unsigned int i = 0; i < workers; i++)
+            threads.push_back(std::thread(&COSMPThreadPool::work, this, generation));
+    }
+
+    ~COSMPThreadPool()
+    {
+        stop();
+    }
+
+    /* Number of worker threads, not counting the calling thread */
+    unsigned int workers() const { return (unsigned int)threads.size(); }
+
+    /* Changes the number of workers, no batch may be in flight */
+    void resize(unsigned int workers)
+    {
+        stop();
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = false;
+        finished = workers;
+        for (unsigned int i = 0; i < workers; i++)
+            threads.push_back(std::thread(&COSMPThreadPool::work, this, generation));
+    }
+
+    /* Runs task(index) for every index in [0,count), returns when all are done */
+    template<typename Task> void run(size_t count, Task& task)
+    {
+        start(count, &invoke<Task>, &task);
+        wait();
+    }
+
+    /* Hands a batch to the workers without waiting for it */
+    template<typename Task> void start(size_t count, Task& task)
+    {
+        start(count, &invoke<Task>, &task);
+    }
+
+    /* Helps with the current batch, then waits until it is complete */
+    void wait()
+    {
+        execute();
+        std::unique_lock<std::mutex> guard(lock);
+        done.wait(guard, [this]() { return finished == threads.size(); });
+    }
+
+private:
+    COSMPThreadPool(const COSMPThreadPool&);
+    COSMPThreadPool& operator=(const COSMPThreadPool&);
+
+    void stop()
+    {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            stopping = true;
+        }
+        wakeup.notify_all();
+        for (size_t i = 0; i < threads.size(); i++)
+            threads[i].join();
+        threads.clear();
+    }
+
+    template<typename Task> static void invoke(void* task, size_t index)
+    {
+        (*static_cast<Task*>(task))(index);
+    }
+
+    void start(size_t count, void (*function)(void*, size_t), void* context)
+    {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            batchFunction = function;
+            batchContext = context;
+            batchCount = count;
+            nextIndex = 0;
+            finished = 0;
+            generation++;
+        }
+        if (!threads.empty())
+            wakeup.notify_all();
+    }
+
+    /* Claims and runs indices of the current batch until none are left */
+    void execute()
+    {
+        size_t index;
+        while ((index = nextIndex.fetch_add(1)) < batchCount)
+            batchFunction(batchContext, index);
+    }
+
+    /*
+     * Every worker checks in once per batch, so no worker can still be
+     * looking at a batch once wait() has returned for it.
+     */
+    void work(unsigned long long seen)
+    {
+        std::unique_lock<std::mutex> guard(lock);
+        for (;;) {
+            wakeup.wait(guard, [this, seen]() { return stopping || generation != seen; });
+            if (stopping)
+                return;
+            seen = generation;
+            guard.unlock();
+            execute();
+            guard.lock();
+            if (++finished == threads.size())
+                done.notify_one();
+        }
+    }
+
+    std::vector<std::thread> threads;
+    std::mutex lock;
+    std::condition_variable wakeup;
+    std::condition_variable done;
+    unsigned long long generation;
+    size_t finished;
+    bool stopping;
+    void (*batchFunction)(void*, size_t);
+    void* batchContext;
+    size_t batchCount;
+    std::atomic<size_t> nextIndex;
+};
+
+#endif
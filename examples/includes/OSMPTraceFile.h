@@ -0,0 +1,450 @@
+/*
+ * PMSF FMU Framework for FMI 2.0 Co-Simulation FMUs
+ *
+ * (C) 2016 -- 2018 PMSF IT Consulting Pierre R. Mai
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef OSMPTraceFile_h
+#define OSMPTraceFile_h
+
+/*
+ * Trace File
+ *
+ * Read-only memory mapping of an OSI trace file in the length-delimited
+ * .osi format, i.e. serialized messages each preceded by their size as
+ * 32 bit little endian integer.  The frames are found through an index
+ * of their timestamps, byte offsets and sizes, sorted by time, so that
+ * the serialized bytes of the frame for any point in time are found by
+ * binary search and handed out in place, without parsing or copying
+ * them.  The file is read ahead of the frames accessed, in windows of
+ * OSMP_TRACE_READAHEAD bytes, so that page faults are mostly avoided
+ * while replaying.  A truncated last frame, as left by an interrupted
+ * recording, is ignored.
+ *
+ * The index is kept in a sidecar file next to the trace, with the name
+ * of the trace followed by .idx, which is built by walking the trace
+ * once, reading only the size prefixes and timestamps, and is mapped
+ * as it is when the trace is opened again.  A sidecar whose header
+ * does not match the size and modification time of the trace, or whose
+ * records do not lie within the trace in time order, is rebuilt.  If
+ * the sidecar cannot be written, e.g. next to traces on read-only media, the index is kept
+ * in memory instead.
+ */
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <string>
+#include <vector>
+#ifdef _WIN32
+#include <windows.h>
+#undef min
+#undef max
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#include "osi_common.pb.h"
+#include "OSMPWireFormat.h"
+
+/* Bytes of the file to read ahead of the frame accessed */
+#ifndef OSMP_TRACE_READAHEAD
+#define OSMP_TRACE_READAHEAD 16777216
+#endif
+
+/* Frames up to this much later than the time asked for are taken as matching it, in seconds */
+#define OSMP_TRACE_TIME_TOLERANCE 1e-6
+
+#define OSMP_TRACE_INDEX_MAGIC "OSMPTIDX"
+#define OSMP_TRACE_INDEX_VERSION 2
+
+/*
+ * Sidecar index layout, in the byte order of the host, i.e. little
+ * endian on all supported platforms: the header, then one record per
+ * frame, sorted by time and, for equal times, by offset.
+ */
+struct OSMPTraceIndexHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+    /* Size of the trace indexed, to notice traces that were rewritten */
+    uint64_t trace_size;
+    /* Modification time of the trace, to notice traces re-recorded to the same size */
+    uint64_t trace_modified;
+    uint64_t count;
+};
+
+struct OSMPTraceIndexRecord {
+    /* Timestamp in seconds, that of the previous frame for frames without one */
+    double time;
+    /* Offset of the serialized message in the trace, after its size prefix */
+    uint64_t offset;
+    uint64_t size;
+};
+
+/* Read-only mapping of a whole file */
+class COSMPFileMapping {
+public:
+    COSMPFileMapping() : base(NULL), length(0), modified(0)
+#ifdef _WIN32
+        , file(INVALID_HANDLE_VALUE), mapping(NULL)
+#else
+        , fd(-1)
+#endif
+    {}
+    ~COSMPFileMapping() { close(); }
+
+    const uint8_t* data() const { return base; }
+    size_t size() const { return length; }
+    /* Modification time of the file, in the units of the platform */
+    uint64_t modified_time() const { return modified; }
+
+    /* Maps the file, false if it cannot be mapped or is empty */
+    bool open(const std::string& path, bool sequential)
+    {
+        close();
+#ifdef _WIN32
+        file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, sequential ? FILE_FLAG_SEQUENTIAL_SCAN : FILE_FLAG_RANDOM_ACCESS, NULL);
+        LARGE_INTEGER size;
+        FILETIME written;
+        if (file == INVALID_HANDLE_VALUE || !GetFileSizeEx(file, &size) || size.QuadPart == 0 || !GetFileTime(file, NULL, NULL, &written)) {
+            close();
+            return false;
+        }
+        mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+        void* view = mapping != NULL ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : NULL;
+        if (view == NULL) {
+            close();
+            return false;
+        }
+        length = (size_t)size.QuadPart;
+        modified = ((uint64_t)written.dwHighDateTime << 32) | written.dwLowDateTime;
+#else
+        fd = ::open(path.c_str(), O_RDONLY);
+        struct stat info;
+        if (fd < 0 || fstat(fd, &info) != 0 || info.st_size == 0) {
+            close();
+            return false;
+        }
+        void* view = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (view == MAP_FAILED) {
+            close();
+            return false;
+        }
+        length = (size_t)info.st_size;
+#ifdef __APPLE__
+        modified = (uint64_t)info.st_mtimespec.tv_sec*1000000000u + (uint64_t)info.st_mtimespec.tv_nsec;
+#else
+        modified = (uint64_t)info.st_mtim.tv_sec*1000000000u + (uint64_t)info.st_mtim.tv_nsec;
+#endif
+        madvise(view, length, sequential ? MADV_SEQUENTIAL : MADV_RANDOM);
+#endif
+        base = static_cast<const uint8_t*>(view);
+        return true;
+    }
+
+    void close()
+    {
+#ifdef _WIN32
+        if (base != NULL)
+            UnmapViewOfFile(base);
+        if (mapping != NULL)
+            CloseHandle(mapping);
+        if (file != INVALID_HANDLE_VALUE)
+            CloseHandle(file);
+        file = INVALID_HANDLE_VALUE;
+        mapping = NULL;
+#else
+        if (base != NULL)
+            munmap(const_cast<uint8_t*>(base), length);
+        if (fd >= 0)
+            ::close(fd);
+        fd = -1;
+#endif
+        base = NULL;
+        length = 0;
+        modified = 0;
+    }
+
+    /* Advises the system to read the given part of the file soon */
+    void will_need(size_t offset, size_t size) const
+    {
+#ifndef _WIN32
+        size_t page = (size_t)sysconf(_SC_PAGESIZE);
+        size_t begin = offset & ~(page - 1);
+        madvise(const_cast<uint8_t*>(base + begin), offset + size - begin, MADV_WILLNEED);
+#endif
+    }
+
+private:
+    COSMPFileMapping(const COSMPFileMapping&);
+    COSMPFileMapping& operator=(const COSMPFileMapping&);
+
+    const uint8_t* base;
+    size_t length;
+    uint64_t modified;
+#ifdef _WIN32
+    HANDLE file;
+    HANDLE mapping;
+#else
+    int fd;
+#endif
+};
+
+class COSMPTraceFile {
+public:
+    COSMPTraceFile() : records(NULL), count(0), timed(false), aheadBegin(0), aheadEnd(0) {}
+
+    bool is_open() const { return records != NULL; }
+
+    /*
+     * Maps the trace and its index, building the index if there is no
+     * valid one.  timestamp_field is the field number of the timestamp
+     * in the top-level messages of the trace.  Returns false if the
+     * trace cannot be mapped or holds no frame.
+     */
+    bool open(const std::string& path, uint32_t timestamp_field)
+    {
+        close();
+        if (!trace.open(path, true))
+            return false;
+        std::string sidecar = path + ".idx";
+        if (!open_index(sidecar)) {
+            build_index(timestamp_field);
+            if (!built.empty() && write_index(sidecar) && open_index(sidecar))
+                std::vector<OSMPTraceIndexRecord>().swap(built);
+            else if (!built.empty())
+                use_index(&built[0], built.size());
+        }
+        if (records == NULL) {
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    void close()
+    {
+        trace.close();
+        index.close();
+        built.clear();
+        records = NULL;
+        count = 0;
+        timed = false;
+        aheadBegin = aheadEnd = 0;
+    }
+
+    size_t frame_count() const { return count; }
+    size_t frame_size(size_t frame) const { return (size_t)records[frame].size; }
+    double frame_time(size_t frame) const { return records[frame].time; }
+    /* True if the frames carry distinct timestamps, so that find() can tell them apart */
+    bool has_timestamps() const { return timed; }
+
+    /* Last frame at or before time, the first frame for times before the trace */
+    size_t find(double time) const
+    {
+        const OSMPTraceIndexRecord* end = records + count;
+        const OSMPTraceIndexRecord* later = std::upper_bound(records, end, time + OSMP_TRACE_TIME_TOLERANCE, before);
+        return later == records ? 0 : (size_t)(later - records) - 1;
+    }
+
+    /* Serialized bytes of a frame, valid until the trace is closed */
+    const uint8_t* frame_data(size_t frame)
+    {
+        read_ahead((size_t)records[frame].offset, (size_t)records[frame].size);
+        return trace.data() + records[frame].offset;
+    }
+
+private:
+    COSMPTraceFile(const COSMPTraceFile&);
+    COSMPTraceFile& operator=(const COSMPTraceFile&);
+
+    static bool before(double time, const OSMPTraceIndexRecord& record) { return time < record.time; }
+    static bool earlier(const OSMPTraceIndexRecord& a, const OSMPTraceIndexRecord& b) { return a.time < b.time; }
+
+    void use_index(const OSMPTraceIndexRecord* first, size_t n)
+    {
+        records = first;
+        count = n;
+        timed = n > 1 && records[n-1].time > records[0].time;
+    }
+
+    /*
+     * Maps the sidecar, if it is valid for the trace: its header has to
+     * match the trace, and its records have to lie within the trace and
+     * be sorted, so that a corrupt or foreign sidecar is never used to
+     * read the mapping.
+     */
+    bool open_index(const std::string& sidecar)
+    {
+        if (!index.open(sidecar, false))
+            return false;
+        OSMPTraceIndexHeader header;
+        if (index.size() < sizeof(header)) {
+            index.close();
+            return false;
+        }
+        memcpy(&header, index.data(), sizeof(header));
+        if (memcmp(header.magic, OSMP_TRACE_INDEX_MAGIC, sizeof(header.magic)) != 0 ||
+            header.version != OSMP_TRACE_INDEX_VERSION ||
+            header.record_size != sizeof(OSMPTraceIndexRecord) ||
+            header.trace_size != trace.size() ||
+            header.trace_modified != trace.modified_time() ||
+            header.count == 0 ||
+            header.count > (index.size() - sizeof(header)) / sizeof(OSMPTraceIndexRecord)) {
+            index.close();
+            return false;
+        }
+        const OSMPTraceIndexRecord* first = reinterpret_cast<const OSMPTraceIndexRecord*>(index.data() + sizeof(header));
+        if (!valid_records(first, (size_t)header.count)) {
+            index.close();
+            return false;
+        }
+        use_index(first, (size_t)header.count);
+        return true;
+    }
+
+    /* True if every record lies after a size prefix within the trace, sorted by time and offset */
+    bool valid_records(const OSMPTraceIndexRecord* first, size_t n) const
+    {
+        uint64_t length = trace.size();
+        for (size_t i = 0; i < n; i++) {
+            const OSMPTraceIndexRecord& record = first[i];
+            if (record.offset < 4 || record.size > INT32_MAX || record.size > length || record.offset > length - record.size)
+                return false;
+            /* Also rejects times that are not a number */
+            if (!(record.time == record.time))
+                return false;
+            if (i > 0 && !(record.time > first[i-1].time || (record.time == first[i-1].time && record.offset > first[i-1].offset)))
+                return false;
+        }
+        return true;
+    }
+
+    /* Walks the size prefixes and timestamps of the trace */
+    void build_index(uint32_t timestamp_field)
+    {
+        const uint8_t* data = trace.data();
+        size_t length = trace.size();
+        size_t offset = 0;
+        double time = 0.0;
+        while (length - offset >= 4) {
+            uint32_t size = (uint32_t)data[offset] | ((uint32_t)data[offset+1] << 8) | ((uint32_t)data[offset+2] << 16) | ((uint32_t)data[offset+3] << 24);
+            /* Frames must fit into the size of a binary variable */
+            if (size > INT32_MAX || size > length - offset - 4)
+                break;
+            OSMPTraceIndexRecord record;
+            record.offset = offset + 4;
+            record.size = size;
+            record.time = read_timestamp(data + offset + 4, size, timestamp_field, time);
+            time = record.time;
+            built.push_back(record);
+            offset += 4 + (size_t)size;
+        }
+        /* Recordings are normally in order already, then this does not move anything */
+        std::stable_sort(built.begin(), built.end(), earlier);
+    }
+
+    /* Timestamp of a message, or the given fallback if it has none */
+    static double read_timestamp(const uint8_t* data, size_t size, uint32_t timestamp_field, double fallback)
+    {
+        COSMPWireReader reader(data, size);
+        uint32_t field, wiretype;
+        while (reader.next(field, wiretype)) {
+            if (field != timestamp_field || wiretype != OSMP_WIRETYPE_LENGTH_DELIMITED) {
+                if (!reader.skip(wiretype))
+                    break;
+                continue;
+            }
+            COSMPWireReader timestamp;
+            if (!reader.read_message(timestamp))
+                break;
+            uint64_t seconds = 0, nanos = 0, value;
+            while (timestamp.next(field, wiretype)) {
+                if (wiretype != OSMP_WIRETYPE_VARINT) {
+                    if (!timestamp.skip(wiretype))
+                        break;
+                    continue;
+                }
+                if (!timestamp.read_varint(value))
+                    break;
+                if (field == osi3::Timestamp::kSecondsFieldNumber)
+                    seconds = value;
+                else if (field == osi3::Timestamp::kNanosFieldNumber)
+                    nanos = value;
+            }
+            return (double)(int64_t)seconds + (double)(uint32_t)nanos*1e-9;
+        }
+        return fallback;
+    }
+
+    /* Writes the index built to the sidecar, replacing any stale one */
+    bool write_index(const std::string& sidecar)
+    {
+        OSMPTraceIndexHeader header;
+        memcpy(header.magic, OSMP_TRACE_INDEX_MAGIC, sizeof(header.magic));
+        header.version = OSMP_TRACE_INDEX_VERSION;
+        header.record_size = sizeof(OSMPTraceIndexRecord);
+        header.trace_size = trace.size();
+        header.trace_modified = trace.modified_time();
+        header.count = built.size();
+        /* Written under another name first, so that readers never see a partial index */
+        std::string temporary = sidecar + ".tmp";
+        FILE* file = fopen(temporary.c_str(), "wb");
+        if (file == NULL)
+            return false;
+        bool written = fwrite(&header, sizeof(header), 1, file) == 1 &&
+            fwrite(&built[0], sizeof(OSMPTraceIndexRecord), built.size(), file) == built.size();
+        written = fclose(file) == 0 && written;
+#ifdef _WIN32
+        if (written)
+            written = MoveFileExA(temporary.c_str(), sidecar.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+        if (written)
+            written = rename(temporary.c_str(), sidecar.c_str()) == 0;
+#endif
+        if (!written)
+            remove(temporary.c_str());
+        return written;
+    }
+
+    /*
+     * Advises the window after a frame to be read, once the frame gets
+     * near the end of the part advised so far, or lies outside of it.
+     */
+    void read_ahead(size_t offset, size_t size)
+    {
+        bool inside = offset >= aheadBegin && offset <= aheadEnd;
+        if (inside && (offset + size + OSMP_TRACE_READAHEAD/2 <= aheadEnd || aheadEnd == trace.size()))
+            return;
+        size_t from = offset;
+        if (inside)
+            from = aheadEnd;
+        else
+            aheadBegin = offset;
+        aheadEnd = offset + size + OSMP_TRACE_READAHEAD;
+        if (aheadEnd > trace.size())
+            aheadEnd = trace.size();
+        trace.will_need(from, aheadEnd - from);
+    }
+
+    COSMPFileMapping trace;
+    COSMPFileMapping index;
+    /* Index kept in memory if the sidecar cannot be written */
+    std::vector<OSMPTraceIndexRecord> built;
+    const OSMPTraceIndexRecord* records;
+    size_t count;
+    bool timed;
+    /* Part of the trace already advised to be read */
+    size_t aheadBegin, aheadEnd;
+};
+
+#endif
@@ -0,0 +1,178 @@
+/*
+ * PMSF FMU Framework for FMI 2.0 Co-Simulation FMUs
+ *
+ * (C) 2016 -- 2018 PMSF IT Consulting Pierre R. Mai
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef OSMPTraceRecorder_h
+#define OSMPTraceRecorder_h
+
+/*
+ * Trace Recorder
+ *
+ * Records serialized messages to an OSI trace file in the
+ * length-delimited .osi format, as read by OSMPTraceFile.h, without
+ * waiting for the disk.  record() only copies the message behind its
+ * size prefix into a ring buffer of fixed size, which needs no lock as
+ * there is only one thread recording, and a background thread writes
+ * out what has accumulated in large sequential writes.  Messages that
+ * do not fit into the space left in the ring, because the disk falls
+ * behind, are dropped and counted instead, so that memory stays
+ * bounded and the recording thread is never held up.
+ *
+ * Messages are copied rather than referenced, as the output buffers
+ * they come from are reused after a few steps, which a disk that falls
+ * behind could not keep up with.
+ */
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+/* Bytes accumulated before the writer is woken up, it also wakes up periodically */
+#define OSMP_RECORDER_BATCH 1048576
+#define OSMP_RECORDER_PERIOD_MS 50
+
+class COSMPTraceRecorder {
+public:
+    COSMPTraceRecorder() : file(NULL), capacity(0), head(0), tail(0), stopping(false), failed(false), recordedFrames(0), droppedFrames(0), droppedBytes(0) {}
+    ~COSMPTraceRecorder() { close(); }
+
+    bool is_open() const { return file != NULL; }
+
+    /* Creates the trace file and starts the writer, with a ring of buffer_size bytes */
+    bool open(const std::string& path, size_t buffer_size)
+    {
+        close();
+        file = fopen(path.c_str(), "wb");
+        if (file == NULL)
+            return false;
+        /* Writes are large already, buffering them again would only copy */
+        setvbuf(file, NULL, _IONBF, 0);
+        ring.reset(new uint8_t[buffer_size]);
+        capacity = buffer_size;
+        head.store(0, std::memory_order_relaxed);
+        tail.store(0, std::memory_order_relaxed);
+        stopping.store(false, std::memory_order_relaxed);
+        failed.store(false, std::memory_order_relaxed);
+        recordedFrames = droppedFrames = droppedBytes = 0;
+        writer = std::thread(&COSMPTraceRecorder::work, this);
+        return true;
+    }
+
+    /* Writes out everything recorded so far and closes the trace file */
+    void close()
+    {
+        if (file == NULL)
+            return;
+        {
+            std::lock_guard<std::mutex> guard(mutex);
+            stopping.store(true, std::memory_order_release);
+        }
+        wakeup.notify_one();
+        writer.join();
+        fclose(file);
+        file = NULL;
+        ring.reset();
+        capacity = 0;
+    }
+
+    /* Queues a message for writing, returns false if it was dropped */
+    bool record(const void* data, size_t size)
+    {
+        uint64_t h = head.load(std::memory_order_relaxed);
+        uint64_t pending = h - tail.load(std::memory_order_acquire);
+        if (file == NULL || size > UINT32_MAX || 4 + size > capacity - pending || failed.load(std::memory_order_relaxed)) {
+            droppedFrames++;
+            droppedBytes += size;
+            return false;
+        }
+        uint8_t prefix[4] = { (uint8_t)size, (uint8_t)(size >> 8), (uint8_t)(size >> 16), (uint8_t)(size >> 24) };
+        copy_in(h, prefix, 4);
+        copy_in(h + 4, data, size);
+        head.store(h + 4 + size, std::memory_order_release);
+        recordedFrames++;
+        /* Only wake the writer once per batch, it does not miss anything otherwise */
+        if (pending < OSMP_RECORDER_BATCH && pending + 4 + size >= OSMP_RECORDER_BATCH)
+            wakeup.notify_one();
+        return true;
+    }
+
+    uint64_t recorded_frames() const { return recordedFrames; }
+    uint64_t dropped_frames() const { return droppedFrames; }
+    uint64_t dropped_bytes() const { return droppedBytes; }
+    /* True if writing to the trace file failed, everything recorded since is dropped */
+    bool write_failed() const { return failed.load(std::memory_order_relaxed); }
+
+private:
+    COSMPTraceRecorder(const COSMPTraceRecorder&);
+    COSMPTraceRecorder& operator=(const COSMPTraceRecorder&);
+
+    void copy_in(uint64_t position, const void* data, size_t size)
+    {
+        size_t offset = (size_t)(position % capacity);
+        size_t first = size < capacity - offset ? size : capacity - offset;
+        memcpy(&ring[offset], data, first);
+        if (size > first)
+            memcpy(&ring[0], static_cast<const uint8_t*>(data) + first, size - first);
+    }
+
+    void work()
+    {
+        for (;;) {
+            uint64_t t = tail.load(std::memory_order_relaxed);
+            bool stop = stopping.load(std::memory_order_acquire);
+            uint64_t h = head.load(std::memory_order_acquire);
+            if (h == t && stop)
+                break;
+            if (h - t < OSMP_RECORDER_BATCH && !stop) {
+                std::unique_lock<std::mutex> lock(mutex);
+                wakeup.wait_for(lock, std::chrono::milliseconds(OSMP_RECORDER_PERIOD_MS), [this, t] {
+                    return stopping.load(std::memory_order_acquire) || head.load(std::memory_order_acquire) - t >= OSMP_RECORDER_BATCH;
+                });
+                h = head.load(std::memory_order_acquire);
+                if (h == t)
+                    continue;
+            }
+            /* At most two writes, the ring may wrap around in between */
+            size_t offset = (size_t)(t % capacity);
+            size_t size = (size_t)(h - t);
+            size_t first = size < capacity - offset ? size : capacity - offset;
+            if (!failed.load(std::memory_order_relaxed) &&
+                (fwrite(&ring[offset], 1, first, file) != first ||
+                 (size > first && fwrite(&ring[0], 1, size - first, file) != size - first)))
+                failed.store(true, std::memory_order_relaxed);
+            tail.store(h, std::memory_order_release);
+        }
+    }
+
+    FILE* file;
+    std::unique_ptr<uint8_t[]> ring;
+    size_t capacity;
+    /* Bytes queued and bytes written since opening, the difference is in the ring */
+    std::atomic<uint64_t> head;
+    std::atomic<uint64_t> tail;
+    std::atomic<bool> stopping;
+    std::atomic<bool> failed;
+    std::mutex mutex;
+    std::condition_variable wakeup;
+    std::thread writer;
+    /* Only used by the recording thread */
+    uint64_t recordedFrames;
+    uint64_t droppedFrames;
+    uint64_t droppedBytes;
+};
+
+#endif
@@ -0,0 +1,164 @@
+/*
+ * PMSF FMU Framework for FMI 2.0 Co-Simulation FMUs
+ *
+ * (C) 2016 -- 2018 PMSF IT Consulting Pierre R. Mai
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef OSMPTrackTable_h
+#define OSMPTrackTable_h
+
+/*
+ * Track Table
+ *
+ * Tracks of detected objects, keyed by ground truth id, which keep
+ * their tracking id for as long as the object is detected at least
+ * every max_age frames.  Objects that cannot be told apart by their
+ * id, i.e. those without one or with an id already seen in the same
+ * frame, are not tracked but get a fresh tracking id every frame.  Every track keeps the last few positions of
+ * its object, e.g. for estimating velocities.  Tracks and histories
+ * live in pooled storage that is reused when tracks are dropped, and
+ * lookups go through OSMPIdIndex.h, so that a table that has reached
+ * its size does not touch the heap anymore.
+ */
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "OSMPIdIndex.h"
+
+/* Number of positions kept per track */
+#ifndef OSMP_TRACK_HISTORY
+#define OSMP_TRACK_HISTORY 8
+#endif
+
+struct OSMPTrackSample {
+    double time;
+    double x, y, z;
+};
+
+class COSMPTrackTable {
+public:
+    static const size_t npos = (size_t)-1;
+
+    explicit COSMPTrackTable(unsigned int max_age = 10) : maxAge(max_age), current(0), frame(0), nextTrackingId(0) {}
+
+    /* Drops all tracks and starts tracking ids from 0 again */
+    void clear()
+    {
+        handles[0].clear();
+        handles[1].clear();
+        for (size_t slot = 0; slot < tracks.size(); slot++)
+            if (tracks[slot].live) {
+                tracks[slot].live = false;
+                unused.push_back((uint32_t)slot);
+            }
+        nextTrackingId = 0;
+    }
+
+    /* Starts a new frame, to be followed by update() for every detected object and end_frame() */
+    void begin_frame()
+    {
+        current ^= 1;
+        handles[current].clear();
+        frame++;
+    }
+
+    /*
+     * Returns the track of an object, created if it is new, and adds the
+     * position to its history; npos if the id was already updated in
+     * this frame, as it then belongs to another object.
+     */
+    size_t update(uint64_t id, double time, double x, double y, double z)
+    {
+        size_t slot = handles[current].find(id);
+        if (slot != COSMPIdIndex::npos && tracks[slot].lastFrame == frame)
+            return npos;
+        slot = handles[current ^ 1].find(id);
+        if (slot == COSMPIdIndex::npos) {
+            if (unused.empty()) {
+                slot = tracks.size();
+                tracks.push_back(Track());
+                samples.resize(samples.size() + OSMP_TRACK_HISTORY);
+            } else {
+                slot = unused.back();
+                unused.pop_back();
+            }
+            Track& track = tracks[slot];
+            track.id = id;
+            track.trackingId = nextTrackingId++;
+            track.firstTime = time;
+            track.count = 0;
+            track.head = 0;
+            track.live = true;
+        }
+        handles[current].insert(id, slot);
+        Track& track = tracks[slot];
+        track.lastFrame = frame;
+        if (track.count == 0 || sample(slot, 0).time != time) {
+            track.head = (track.head + 1) % OSMP_TRACK_HISTORY;
+            if (track.count < OSMP_TRACK_HISTORY)
+                track.count++;
+        }
+        OSMPTrackSample& latest = samples[slot*OSMP_TRACK_HISTORY + track.head];
+        latest.time = time;
+        latest.x = x;
+        latest.y = y;
+        latest.z = z;
+        return slot;
+    }
+
+    /* Keeps tracks that were missed for up to max_age frames, drops older ones */
+    void end_frame()
+    {
+        for (size_t slot = 0; slot < tracks.size(); slot++) {
+            Track& track = tracks[slot];
+            if (!track.live || track.lastFrame == frame)
+                continue;
+            if (frame - track.lastFrame > maxAge) {
+                track.live = false;
+                unused.push_back((uint32_t)slot);
+            } else {
+                handles[current].insert(track.id, slot);
+            }
+        }
+    }
+
+    /* Tracking id for an object that is not tracked, never handed out again */
+    uint64_t untracked_id() { return nextTrackingId++; }
+
+    uint64_t tracking_id(size_t slot) const { return tracks[slot].trackingId; }
+    double first_time(size_t slot) const { return tracks[slot].firstTime; }
+    size_t history_size(size_t slot) const { return tracks[slot].count; }
+    /* Position recorded age updates ago, 0 being the latest */
+    const OSMPTrackSample& sample(size_t slot, size_t age) const
+    {
+        return samples[slot*OSMP_TRACK_HISTORY + (tracks[slot].head + OSMP_TRACK_HISTORY - age) % OSMP_TRACK_HISTORY];
+    }
+
+private:
+    struct Track {
+        Track() : id(0), trackingId(0), firstTime(0.0), lastFrame(0), count(0), head(0), live(false) {}
+        uint64_t id;
+        uint64_t trackingId;
+        double firstTime;
+        unsigned long long lastFrame;
+        uint32_t count, head;
+        bool live;
+    };
+
+    unsigned int maxAge;
+    /* Slots of the tracks by id, for the current and the previous frame */
+    int current;
+    COSMPIdIndex handles[2];
+    unsigned long long frame;
+    uint64_t nextTrackingId;
+    std::vector<Track> tracks;
+    std::vector<OSMPTrackSample> samples;
+    std::vector<uint32_t> unused;
+};
+
+#endif
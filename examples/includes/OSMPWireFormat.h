@@ -0,0 +1,330 @@
+/*
+ * PMSF FMU Framework for FMI 2.0 Co-Simulation FMUs
+ *
+ * (C) 2016 -- 2018 PMSF IT Consulting Pierre R. Mai
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef OSMPWireFormat_h
+#define OSMPWireFormat_h
+
+/*
+ * Protocol Buffer Wire Format Helpers
+ *
+ * Minimal, allocation-free access to the protocol buffer wire format,
+ * for models that want to pick individual fields out of an OSMP binary
+ * buffer in place, or write them out directly, instead of materializing
+ * the complete message tree.  Field numbers should be taken from the
+ * generated kXxxFieldNumber constants of the OSI classes, so that the
+ * scanners follow the OSI version the model is compiled against.
+ */
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+/* Wire Types */
+#define OSMP_WIRETYPE_VARINT 0
+#define OSMP_WIRETYPE_FIXED64 1
+#define OSMP_WIRETYPE_LENGTH_DELIMITED 2
+#define OSMP_WIRETYPE_START_GROUP 3
+#define OSMP_WIRETYPE_END_GROUP 4
+#define OSMP_WIRETYPE_FIXED32 5
+
+/* Encoding Helpers */
+inline size_t wire_varint_size(uint64_t value)
+{
+    size_t size = 1;
+    while (value >= 0x80) {
+        value >>= 7;
+        size++;
+    }
+    return size;
+}
+
+inline uint8_t* wire_write_varint(uint8_t* target, uint64_t value)
+{
+    while (value >= 0x80) {
+        *target++ = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    *target++ = (uint8_t)value;
+    return target;
+}
+
+inline uint8_t* wire_write_fixed64(uint8_t* target, uint64_t value)
+{
+    for (int i = 0; i < 8; i++)
+        *target++ = (uint8_t)(value >> (8*i));
+    return target;
+}
+
+inline uint32_t wire_tag(uint32_t field, uint32_t wiretype)
+{
+    return (field << 3) | wiretype;
+}
+
+/* Size of a complete length-delimited field with the given payload size */
+inline size_t wire_length_delimited_size(uint32_t field, size_t size)
+{
+    return wire_varint_size(wire_tag(field, OSMP_WIRETYPE_LENGTH_DELIMITED)) + wire_varint_size(size) + size;
+}
+
+/* Writes a complete length-delimited field, returning the end of it */
+inline uint8_t* wire_write_length_delimited(uint8_t* target, uint32_t field, const void* data, size_t size)
+{
+    target = wire_write_varint(target, wire_tag(field, OSMP_WIRETYPE_LENGTH_DELIMITED));
+    target = wire_write_varint(target, size);
+    if (size > 0)
+        memcpy(target, data, size);
+    return target + size;
+}
+
+/*
+ * Streaming writer of a message in wire format, as an alternative to
+ * building and serializing the message tree.  Nested messages are
+ * opened by begin_message(), which leaves room for their length, by
+ * default one byte, and closed by end_message(), which patches the
+ * length in, moving the content in case the length needs more or fewer
+ * bytes.  Large messages should pass their expected size, e.g. that of
+ * the previous step, to avoid moving them.
+ * Written in ascending field number order, the bytes are the same as
+ * those of the serialized message tree.  The buffer only ever grows,
+ * so that a writer that is cleared and reused does not touch the heap
+ * once it has reached its size.
+ */
+class COSMPWireWriter {
+public:
+    COSMPWireWriter() : length(0) {}
+
+    void clear() { length = 0; }
+    size_t size() const { return length; }
+    const uint8_t* data() const { return buffer.empty() ? NULL : &buffer[0]; }
+
+    /* Varint field, negative int32 and enum values are sign-extended to 64 bits as usual */
+    void write_varint(uint32_t field, uint64_t value)
+    {
+        uint8_t* target = reserve(20);
+        target = wire_write_varint(target, wire_tag(field, OSMP_WIRETYPE_VARINT));
+        commit(wire_write_varint(target, value));
+    }
+
+    void write_double(uint32_t field, double value)
+    {
+        uint64_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+        uint8_t* target = reserve(13);
+        target = wire_write_varint(target, wire_tag(field, OSMP_WIRETYPE_FIXED64));
+        commit(wire_write_fixed64(target, bits));
+    }
+
+    /* Overwrites the value of a double field already written, whose 8 bytes start at offset */
+    void patch_double(size_t offset, double value)
+    {
+        uint64_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+        wire_write_fixed64(&buffer[offset], bits);
+    }
+
+    /* Length-delimited field, e.g. an already encoded submessage */
+    void write_bytes(uint32_t field, const void* data, size_t size)
+    {
+        commit(wire_write_length_delimited(reserve(wire_length_delimited_size(field, size)), field, data, size));
+    }
+
+    /* Already encoded fields */
+    void append(const void* data, size_t size)
+    {
+        if (size > 0)
+            memcpy(reserve(size), data, size);
+        length += size;
+    }
+
+    /* Starts a submessage, returns the mark to pass to end_message() */
+    size_t begin_message(uint32_t field, size_t expected = 0)
+    {
+        size_t room = wire_varint_size(expected);
+        uint8_t* target = reserve(5 + room);
+        target = wire_write_varint(target, wire_tag(field, OSMP_WIRETYPE_LENGTH_DELIMITED));
+        /* The room left is noted in its first byte until the length is known */
+        *target = (uint8_t)room;
+        commit(target + room);
+        return length - room;
+    }
+
+    /* Ends a submessage, returns its size */
+    size_t end_message(size_t mark)
+    {
+        size_t room = buffer[mark];
+        size_t content = length - (mark + room);
+        size_t needed = wire_varint_size(content);
+        if (needed != room) {
+            if (needed > room)
+                reserve(needed - room);
+            memmove(&buffer[mark + needed], &buffer[mark + room], content);
+            length = length + needed - room;
+        }
+        wire_write_varint(&buffer[mark], content);
+        return content;
+    }
+
+private:
+    /* Room for at least n more bytes, returns the end of the content */
+    uint8_t* reserve(size_t n)
+    {
+        if (length + n > buffer.size())
+            buffer.resize(buffer.size() * 2 > length + n ? buffer.size() * 2 : length + n);
+        return &buffer[length];
+    }
+
+    void commit(uint8_t* end) { length = end - &buffer[0]; }
+
+    std::vector<uint8_t> buffer;
+    size_t length;
+};
+
+/* Sequential reader over one (sub)message */
+class COSMPWireReader {
+public:
+    COSMPWireReader() : ptr(NULL), end(NULL), failed(false) {}
+    COSMPWireReader(const void* data, size_t size)
+        : ptr(static_cast<const uint8_t*>(data)), end(static_cast<const uint8_t*>(data)+size), failed(data == NULL && size > 0) {}
+
+    /* Start of the unread part of the buffer */
+    const uint8_t* position() const { return ptr; }
+    /* True if the message was malformed (truncated data, bad tags, ...) */
+    bool error() const { return failed; }
+
+    /* Reads the next tag, returns false at end of message or on error */
+    bool next(uint32_t& field, uint32_t& wiretype)
+    {
+        uint64_t tag;
+        if (failed || ptr >= end || !read_varint(tag))
+            return false;
+        field = (uint32_t)(tag >> 3);
+        wiretype = (uint32_t)(tag & 7);
+        if (field == 0)
+            return fail();
+        return true;
+    }
+
+    bool read_varint(uint64_t& value)
+    {
+        value = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            if (ptr >= end)
+                return fail();
+            uint8_t byte = *ptr++;
+            value |= (uint64_t)(byte & 0x7F) << shift;
+            if (!(byte & 0x80))
+                return true;
+        }
+        return fail();
+    }
+
+    bool read_fixed64(uint64_t& value)
+    {
+        if (end - ptr < 8)
+            return fail();
+        value = 0;
+        for (int i = 7; i >= 0; i--)
+            value = (value << 8) | ptr[i];
+        ptr += 8;
+        return true;
+    }
+
+    bool read_fixed32(uint32_t& value)
+    {
+        if (end - ptr < 4)
+            return fail();
+        value = 0;
+        for (int i = 3; i >= 0; i--)
+            value = (value << 8) | ptr[i];
+        ptr += 4;
+        return true;
+    }
+
+    bool read_double(double& value)
+    {
+        uint64_t bits;
+        if (!read_fixed64(bits))
+            return false;
+        memcpy(&value, &bits, sizeof(value));
+        return true;
+    }
+
+    /* Reads a length-delimited field, returning its payload in place */
+    bool read_bytes(const uint8_t*& data, size_t& size)
+    {
+        uint64_t length;
+        if (!read_varint(length))
+            return false;
+        if (length > (uint64_t)(end - ptr))
+            return fail();
+        data = ptr;
+        size = (size_t)length;
+        ptr += size;
+        return true;
+    }
+
+    /* Reads an embedded message field into a reader positioned on it */
+    bool read_message(COSMPWireReader& message)
+    {
+        const uint8_t* data;
+        size_t size;
+        if (!read_bytes(data, size))
+            return false;
+        message = COSMPWireReader(data, size);
+        return true;
+    }
+
+    /* Skips the value of a field of the given wire type */
+    bool skip(uint32_t wiretype)
+    {
+        uint64_t dummy;
+        const uint8_t* data;
+        size_t size;
+        switch (wiretype) {
+            case OSMP_WIRETYPE_VARINT:
+                return read_varint(dummy);
+            case OSMP_WIRETYPE_FIXED64:
+                if (end - ptr < 8)
+                    return fail();
+                ptr += 8;
+                return true;
+            case OSMP_WIRETYPE_LENGTH_DELIMITED:
+                return read_bytes(data, size);
+            case OSMP_WIRETYPE_START_GROUP:
+                {
+                    uint32_t field, type;
+                    while (next(field, type)) {
+                        if (type == OSMP_WIRETYPE_END_GROUP)
+                            return true;
+                        if (!skip(type))
+                            return false;
+                    }
+                    return fail();
+                }
+            case OSMP_WIRETYPE_FIXED32:
+                if (end - ptr < 4)
+                    return fail();
+                ptr += 4;
+                return true;
+            default:
+                return fail();
+        }
+    }
+
+private:
+    bool fail() { failed = true; ptr = end; return false; }
+
+    const uint8_t* ptr;
+    const uint8_t* end;
+    bool failed;
+};
+
+#endif